@@ -98,6 +98,30 @@ def input(macros):
 #  par.traceRayAlgorithm = 1
 #  par.resetRNG          = False
 #  par.doSolveRTE        = False
+#  par.doNgAccel         = False
+#  par.convMedianSNR     = 0.0
+#  par.convFracConverged = 0.0
+#  par.convMaxRelChange  = 0.0
+#  par.freezeTol         = 0.0
+#  par.freezeRefresh     = 5
+#  par.pathCacheMB       = 0.0
+#  par.jbarSampling      = 0
+#  par.nPhotMin          = 0
+#  par.nPhotMax          = 0
+#  par.lineKernel        = 1
+#  par.statEqSolver      = 0
+#  par.collCacheMB       = 0.0
+#  par.rngType           = 0
+#  par.solverSchedule    = 0
+#  par.gridOrdering      = 0
+#  par.mixedPrecision    = False
+#  par.minPhotonExpTau   = 0.0
+#  par.aliSchedule       = 0
+#  par.aliMinIters       = 5
+#  par.solverUpdate      = 0
+#  par.multigridLevels   = 0
+#  par.lvg_only          = False
+#  par.init_lvg          = False
 #  par.gridOutFiles      = ['','','','',"grid_5_pylime.ds"]
   par.moldatfile        = ["hco+@xpol.dat"] # must be a list, even when there is only 1 item.
 #  par.girdatfile        = ["myGIRs.dat"] # must be a list, even when there is only 1 item.
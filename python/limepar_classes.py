@@ -97,6 +97,30 @@ This is to define the complete list of 'ordinary' parameters which the user can
   _listOfAttrs.append(('traceRayAlgorithm','int',  False, False, 0))
   _listOfAttrs.append(('resetRNG',         'bool', False, False, False))
   _listOfAttrs.append(('doSolveRTE',       'bool', False, False, False))
+  _listOfAttrs.append(('doNgAccel',        'bool', False, False, False))
+  _listOfAttrs.append(('convMedianSNR',    'float',False, False, 0.0))
+  _listOfAttrs.append(('convFracConverged','float',False, False, 0.0))
+  _listOfAttrs.append(('convMaxRelChange', 'float',False, False, 0.0))
+  _listOfAttrs.append(('freezeTol',        'float',False, False, 0.0))
+  _listOfAttrs.append(('freezeRefresh',    'int',  False, False, 5))
+  _listOfAttrs.append(('pathCacheMB',      'float',False, False, 0.0))
+  _listOfAttrs.append(('jbarSampling',     'int',  False, False, 0))
+  _listOfAttrs.append(('nPhotMin',         'int',  False, False, 0))
+  _listOfAttrs.append(('nPhotMax',         'int',  False, False, 0))
+  _listOfAttrs.append(('lineKernel',       'int',  False, False, 1))
+  _listOfAttrs.append(('statEqSolver',     'int',  False, False, 0))
+  _listOfAttrs.append(('collCacheMB',      'float',False, False, 0.0))
+  _listOfAttrs.append(('rngType',          'int',  False, False, 0))
+  _listOfAttrs.append(('solverSchedule',   'int',  False, False, 0))
+  _listOfAttrs.append(('gridOrdering',     'int',  False, False, 0))
+  _listOfAttrs.append(('mixedPrecision',   'bool', False, False, False))
+  _listOfAttrs.append(('minPhotonExpTau',  'float',False, False, 0.0))
+  _listOfAttrs.append(('aliSchedule',      'int',  False, False, 0))
+  _listOfAttrs.append(('aliMinIters',      'int',  False, False, 5))
+  _listOfAttrs.append(('solverUpdate',     'int',  False, False, 0))
+  _listOfAttrs.append(('multigridLevels',  'int',  False, False, 0))
+  _listOfAttrs.append(('lvg_only',         'bool', False, False, False))
+  _listOfAttrs.append(('init_lvg',         'bool', False, False, False))
 
   _listOfAttrs.append(('gridOutFiles',     'str',  True,  False, []))
   _listOfAttrs.append(('moldatfile',       'str',  True,  False, []))
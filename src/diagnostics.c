@@ -57,6 +57,28 @@ This is intended purely as a diagnostic program to compare the parameter values
   printf("        polarization = %d\n", inpars.polarization);
   printf("            nThreads = %d\n", inpars.nThreads);
   printf("         nSolveIters = %d\n", inpars.nSolveIters);
+  printf("       convMedianSNR = %e\n", inpars.convMedianSNR);
+  printf("   convFracConverged = %e\n", inpars.convFracConverged);
+  printf("    convMaxRelChange = %e\n", inpars.convMaxRelChange);
+  printf("           freezeTol = %e\n", inpars.freezeTol);
+  printf("       freezeRefresh = %d\n", inpars.freezeRefresh);
+  printf("         pathCacheMB = %e\n", inpars.pathCacheMB);
+  printf("        jbarSampling = %d\n", inpars.jbarSampling);
+  printf("            nPhotMin = %d\n", inpars.nPhotMin);
+  printf("            nPhotMax = %d\n", inpars.nPhotMax);
+  printf("          lineKernel = %d\n", inpars.lineKernel);
+  printf("        statEqSolver = %d\n", inpars.statEqSolver);
+  printf("         collCacheMB = %e\n", inpars.collCacheMB);
+  printf("             rngType = %d\n", inpars.rngType);
+  printf("      solverSchedule = %d\n", inpars.solverSchedule);
+  printf("        gridOrdering = %d\n", inpars.gridOrdering);
+  printf("     minPhotonExpTau = %e\n", inpars.minPhotonExpTau);
+  printf("         aliSchedule = %d\n", inpars.aliSchedule);
+  printf("         aliMinIters = %d\n", inpars.aliMinIters);
+  printf("        solverUpdate = %d\n", inpars.solverUpdate);
+  printf("     multigridLevels = %d\n", inpars.multigridLevels);
+  printf("            lvg_only = %d\n", inpars.lvg_only);
+  printf("            init_lvg = %d\n", inpars.init_lvg);
 
   if(inpars.moldatfile!=NULL && inpars.girdatfile!=NULL){
     for(i=0;i<MAX_NSPECIES;i++){
@@ -134,6 +156,16 @@ This is intended purely as a diagnostic program to compare the parameter values
   else
     printf("          doSolveRTE = FALSE\n");
 
+  if(inpars.doNgAccel)
+    printf("           doNgAccel = TRUE\n");
+  else
+    printf("           doNgAccel = FALSE\n");
+
+  if(inpars.mixedPrecision)
+    printf("      mixedPrecision = TRUE\n");
+  else
+    printf("      mixedPrecision = FALSE\n");
+
   for(i=0;i<nImages;i++){
     printf("\n");
     printf("Image %d\n", i);
@@ -73,13 +73,17 @@ freeGrid(const unsigned int numPoints, const unsigned short numSpecies\
       free(gp[i_u].v1);
       free(gp[i_u].v2);
       free(gp[i_u].v3);
-      free(gp[i_u].dir);
-      free(gp[i_u].neigh);
+      if(gp[i_u].graph==NULL){
+        free(gp[i_u].dir);
+        free(gp[i_u].neigh);
+        free(gp[i_u].ds);
+      }
       free(gp[i_u].w);
       free(gp[i_u].dens);
-      free(gp[i_u].ds);
       freePopulation(numSpecies, gp[i_u].mol);
     }
+    if(numPoints>0)
+      freeNeighGraph(gp[0].graph);
     free(gp);
   }
 }
@@ -150,6 +154,37 @@ freeMolData(const int nSpecies, molData *md){
   }
 }
 
+/*....................................................................*/
+void
+freeNeighGraph(struct neighGraph *graph){
+  if(graph != NULL){
+    free(graph->firstLink);
+    free(graph->neighI);
+    free(graph->xn);
+    free(graph->ds);
+    free(graph->dir);
+    free(graph->neigh);
+    free(graph);
+  }
+}
+
+/*....................................................................*/
+void
+freeNeighGraphDirs(const unsigned long numPoints, struct grid *gp){
+  /*
+Frees the double-precision link vectors of the neighbour graph, for which the float unit vectors in graph->xn suffice once the grid is complete; the .dir field of each grid point is set to NULL. unpackNeighGraph() and buildNeighGraph() recalculate them if they are needed again.
+  */
+  unsigned long i;
+
+  if(numPoints==0 || gp[0].graph==NULL)
+return;
+
+  free(gp[0].graph->dir);
+  gp[0].graph->dir = NULL;
+  for(i=0;i<numPoints;i++)
+    gp[i].dir = NULL;
+}
+
 /*....................................................................*/
 void
 freePopulation(const unsigned short numSpecies, struct populations *pop){
@@ -177,7 +212,8 @@ freeSomeGridFields(const unsigned int numPoints, const unsigned short numSpecies
     for(i_u=0;i_u<numPoints;i_u++){
       free(gp[i_u].w);
       gp[i_u].w    = NULL;
-      free(gp[i_u].ds);
+      if(gp[i_u].graph==NULL)
+        free(gp[i_u].ds);
       gp[i_u].ds   = NULL;
 
       if(gp[i_u].mol != NULL){
@@ -138,7 +138,7 @@ exit(1);
 /*....................................................................*/
 void
 buildGrid(configInfo *par, struct grid **gp){
-  const gsl_rng_type *ranNumGenType = gsl_rng_ranlxs2;
+  const gsl_rng_type *ranNumGenType = rngTypeFromPar(par->rngType);
   int i,j,k,di,si;
   double theta,semiradius,z,dummyT[2],dummyScalar;
   double *outRandDensities=NULL,*dummyPointer=NULL,x[DIM];
@@ -227,6 +227,7 @@ Generate the grid point locations.
 
     } else if(par->samplingAlgorithm==1){
       setConstDefaults(&rinc);
+      rinc.randGenType = (gsl_rng_type *)ranNumGenType;
 
       if(fixRandomSeeds)
         rinc.randSeed = 342971;
@@ -329,6 +330,8 @@ Generate the remaining values if needed. **Note** that we check a few of them to
     par->pIntensity -= nExtraSinks;
     par->sinkPoints += nExtraSinks;
 
+    reorderGridAlongCurve(par, *gp, dc, numCells);
+
     par->dataFlags |= DS_mask_neighbours;
   }
   distCalc(par, *gp); /* Mallocs and sets .dir & .ds, sets .nphot. We don't store these values so we have to calculate them whether we read a file or not. */
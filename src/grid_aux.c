@@ -22,6 +22,7 @@ void mallocAndSetDefaultGrid(struct grid **gp, const size_t numPoints, const siz
     (*gp)[i].neigh = NULL;
     (*gp)[i].w = NULL;
     (*gp)[i].ds = NULL;
+    (*gp)[i].graph = NULL;
     (*gp)[i].dens=NULL;
     (*gp)[i].t[0]=-1.0;
     (*gp)[i].t[1]=-1.0;
@@ -47,45 +48,81 @@ void mallocAndSetDefaultGrid(struct grid **gp, const size_t numPoints, const siz
   }
 }
 
+/*....................................................................*/
+/* Wall-clock time spent in each of the per-grid-point preprocessing passes, and the number of times each was run, since the last call to reportPrepTimes(). */
+static double prepSeconds[NUM_PREP_PASSES];
+static int prepCalls[NUM_PREP_PASSES];
+
+void addPrepTime(const int passI, const double seconds){
+  prepSeconds[passI] += seconds;
+  prepCalls[passI]++;
+}
+
+/*....................................................................*/
+void reportPrepTimes(void){
+  const char *passNames[NUM_PREP_PASSES] = {"neighbour graph","density check","Doppler widths & mol. densities","level number densities","dust opacities"};
+  char message[STR_LEN_0];
+  int passI;
+
+  for(passI=0;passI<NUM_PREP_PASSES;passI++){
+    if(prepCalls[passI]>0 && !silent){
+      snprintf(message, STR_LEN_0, "Grid pass '%s': %.3f s in %d call%s.", passNames[passI], prepSeconds[passI], prepCalls[passI], prepCalls[passI]==1 ? "" : "s");
+      printMessage(message);
+    }
+    prepSeconds[passI] = 0.0;
+    prepCalls[passI] = 0;
+  }
+}
+
 /*....................................................................*/
 void checkGridDensities(configInfo *par, struct grid *gp){
   /* This checks that none of the density samples is too small. */
-  int i;
+  int i,firstLow;
   static _Bool warningAlreadyIssued=0;
   char errStr[STR_LEN_1];
+  double startTime=omp_get_wtime();
+
+  if(!silent && !warningAlreadyIssued){ /* Warn if any densities too low. */
+    firstLow = par->pIntensity;
+#pragma omp parallel for reduction(min:firstLow) num_threads(par->nThreads)
+    for(i=0;i<par->pIntensity;i++){
+      if(gp[i].dens[0]<TYPICAL_ISM_DENS && i<firstLow)
+        firstLow = i;
+    }
 
-  if(!silent){ /* Warn if any densities too low. */
-    i = 0;
-    while(i<par->pIntensity && !warningAlreadyIssued){
-      if(gp[i].dens[0]<TYPICAL_ISM_DENS){
-        warningAlreadyIssued = 1;
-        snprintf(errStr, STR_LEN_1, "gp[%d].dens[0] at %.1e is below typical values for the ISM (~%.1e).", i, gp[i].dens[0], TYPICAL_ISM_DENS);
-        warning(errStr);
-        warning("This could give you convergence problems. NOTE: no further warnings will be issued.");
-      }
-      i++;
+    if(firstLow<par->pIntensity){
+      warningAlreadyIssued = 1;
+      snprintf(errStr, STR_LEN_1, "gp[%d].dens[0] at %.1e is below typical values for the ISM (~%.1e).", firstLow, gp[firstLow].dens[0], TYPICAL_ISM_DENS);
+      warning(errStr);
+      warning("This could give you convergence problems. NOTE: no further warnings will be issued.");
     }
   }
+  addPrepTime(PREP_CHECK_DENS, omp_get_wtime()-startTime);
 }
 
 /*....................................................................*/
 void calcGridMolDoppler(configInfo *par, molData *md, struct grid *gp){
   int i,id;
+  double startTime=omp_get_wtime();
 
-  for(i=0;i<par->nSpecies;i++){
-    /* Calculate Doppler and thermal line broadening */
-    for(id=0;id<par->ncell;id++) {
+  /* Calculate Doppler and thermal line broadening */
+#pragma omp parallel for private(i) num_threads(par->nThreads) schedule(static)
+  for(id=0;id<par->ncell;id++) {
+    for(i=0;i<par->nSpecies;i++){
       gp[id].mol[i].dopb = sqrt(gp[id].dopb_turb*gp[id].dopb_turb\
                                 + 2.*KBOLTZ/md[i].amass*gp[id].t[0]);
       gp[id].mol[i].binv = 1./gp[id].mol[i].dopb;
     }
   }
+  addPrepTime(PREP_MOL_VALUES, omp_get_wtime()-startTime);
 }
 
 /*....................................................................*/
 void calcGridMolDensities(configInfo *par, struct grid **gp){
   int id,ispec,i;
+  double startTime=omp_get_wtime();
 
+#pragma omp parallel for private(ispec,i) num_threads(par->nThreads) schedule(static)
   for(id=0;id<par->ncell;id++){
     for(ispec=0;ispec<par->nSpecies;ispec++){
       (*gp)[id].mol[ispec].nmol = 0.0;
@@ -94,12 +131,41 @@ void calcGridMolDensities(configInfo *par, struct grid **gp){
                                     *par->nMolWeights[i];
     }
   }
+  addPrepTime(PREP_MOL_VALUES, omp_get_wtime()-startTime);
+}
+
+/*....................................................................*/
+void calcGridMolValues(configInfo *par, molData *md, struct grid *gp){
+  /*
+Does the work of calcGridMolDoppler() and, if par->useAbun, of calcGridMolDensities(), in a single pass over the grid.
+  */
+  int id,ispec,i;
+  double startTime=omp_get_wtime();
+
+#pragma omp parallel for private(ispec,i) num_threads(par->nThreads) schedule(static)
+  for(id=0;id<par->ncell;id++){
+    for(ispec=0;ispec<par->nSpecies;ispec++){
+      gp[id].mol[ispec].dopb = sqrt(gp[id].dopb_turb*gp[id].dopb_turb\
+                                    + 2.*KBOLTZ/md[ispec].amass*gp[id].t[0]);
+      gp[id].mol[ispec].binv = 1./gp[id].mol[ispec].dopb;
+
+      if(par->useAbun){
+        gp[id].mol[ispec].nmol = 0.0;
+        for(i=0;i<par->numDensities;i++)
+          gp[id].mol[ispec].nmol += gp[id].mol[ispec].abun*gp[id].dens[i]\
+                                   *par->nMolWeights[i];
+      }
+    }
+  }
+  addPrepTime(PREP_MOL_VALUES, omp_get_wtime()-startTime);
 }
 
 /*....................................................................*/
 void calcGridMolSpecNumDens(configInfo *par, molData *md, struct grid *gp){
   int gi,ispec,ei;
+  double startTime=omp_get_wtime();
 
+#pragma omp parallel for private(ispec,ei) num_threads(par->nThreads) schedule(static)
   for(gi=0;gi<par->ncell;gi++){
     for(ispec=0;ispec<par->nSpecies;ispec++){
       for(ei=0;ei<md[ispec].nlev;ei++){
@@ -108,6 +174,7 @@ void calcGridMolSpecNumDens(configInfo *par, molData *md, struct grid *gp){
       }
     }
   }
+  addPrepTime(PREP_SPEC_NUM_DENS, omp_get_wtime()-startTime);
 }
 
 /*....................................................................*/
@@ -128,7 +195,7 @@ Elements of structs are set as follows:
 	struct grid *gp:
 		.sink
 		.numNeigh
-		.neigh (this is malloc'd too large and at present not realloc'd.)
+		.neigh (this is malloc'd too large and at present not realloc'd; distCalc() later packs it into a struct neighGraph.)
 
 	cellType *dc (if getCells>0):
 		.id
@@ -180,6 +247,10 @@ Elements of structs are set as follows:
     }
   }
 
+  /* Any neighbour graph from a previous call must be unpacked first, because the .neigh arrays of its points are not separately malloc'd.
+  */
+  unpackNeighGraph(numPoints, gp);
+
   /* Malloc .neigh for each grid point. At present it is not known how many neighbours a point will have, so all the mallocs are larger than needed.
   */
   FORALLvertices {
@@ -358,29 +429,295 @@ Suppose further that the old value of gp[i].neigh[j] is &gp[30]. We detect that
 }
 
 /*....................................................................*/
-void distCalc(configInfo *par, struct grid *gp){
-  int i,k,l;
+struct curveKeyType {
+  unsigned long long key;
+  unsigned long index;
+};
 
-  for(i=0;i<par->ncell;i++){
-    free(gp[i].dir);
-    free(gp[i].ds);
-    gp[i].dir=malloc(sizeof(*(gp[i].dir)) *gp[i].numNeigh);
-    gp[i].ds =malloc(sizeof(double)*gp[i].numNeigh);
-    memset(gp[i].dir, 0., sizeof(*(gp[i].dir)) * gp[i].numNeigh);
-    memset(gp[i].ds, 0., sizeof(double) * gp[i].numNeigh);
+/*....................................................................*/
+int
+_compareCurveKeys(const void *a, const void *b){
+  const struct curveKeyType *ka=a, *kb=b;
+
+  if(ka->key   < kb->key)   return -1;
+  if(ka->key   > kb->key)   return  1;
+  if(ka->index < kb->index) return -1; /* Ties keep their original order, so the result does not depend on the qsort implementation. */
+  if(ka->index > kb->index) return  1;
+  return 0;
+}
+
+/*....................................................................*/
+void
+_hilbertTranspose(unsigned int *coords, const int numBits){
+  /*
+Converts the integer coordinates, numBits bits each, in place to the 'transposed' form of their Hilbert index, from which the index itself is got by interleaving the bits in the same way as for a Morton key. The algorithm is that of
+
+	Skilling, J. (2004), AIP Conference Proceedings 707, 381
+  */
+  unsigned int p,q,t;
+  int i;
+
+  for(q=1u<<(numBits-1);q>1;q>>=1){
+    p = q-1;
+    for(i=0;i<DIM;i++){
+      if(coords[i] & q)
+        coords[0] ^= p;
+      else{
+        t = (coords[0]^coords[i]) & p;
+        coords[0] ^= t;
+        coords[i] ^= t;
+      }
+    }
+  }
+
+  for(i=1;i<DIM;i++)
+    coords[i] ^= coords[i-1];
+  t = 0;
+  for(q=1u<<(numBits-1);q>1;q>>=1){
+    if(coords[DIM-1] & q)
+      t ^= q-1;
+  }
+  for(i=0;i<DIM;i++)
+    coords[i] ^= t;
+}
+
+/*....................................................................*/
+unsigned long long
+_curveKey(const int ordering, const double *x, const double radius){
+  const int numBits = 63/DIM>31 ? 31 : 63/DIM;
+  const double maxCoord = (double)((1u<<numBits)-1);
+  unsigned int coords[DIM];
+  unsigned long long key=0;
+  double u;
+  int i,bitI;
+
+  for(i=0;i<DIM;i++){
+    u = 0.5*(x[i]/radius + 1.0);
+    if(u<0.0) u = 0.0;
+    if(u>1.0) u = 1.0;
+    coords[i] = (unsigned int)(u*maxCoord);
+  }
+
+  if(ordering==GRID_ORDER_HILBERT)
+    _hilbertTranspose(coords, numBits);
+
+  for(bitI=numBits-1;bitI>=0;bitI--){
+    for(i=0;i<DIM;i++)
+      key = (key<<1) | ((coords[i]>>bitI) & 1u);
+  }
+
+  return key;
+}
+
+/*....................................................................*/
+void
+reorderGridAlongCurve(configInfo *par, struct grid *gp, struct cell *dc, const unsigned long numCells){
+  /*
+Renumbers the grid points in the order in which they fall along a Morton or Hilbert space-filling curve (according to par->gridOrdering) through the model volume, so that points which are neighbours in space are for the most part also near each other in memory. The non-sink points 0 to par->pIntensity-1 and the sink points after them are sorted separately, so the division between them is preserved. The .id values are reset to be sequential, and the .neigh pointers, as well as the vertices of the Delaunay cells if these are supplied, are redirected to the new locations. All other data move with their points.
+
+This should be called after reorderGrid(), but before anything which refers to grid points by index has been set up.
+  */
+  const unsigned long numPoints=(unsigned long)par->ncell;
+  struct curveKeyType *keys;
+  unsigned long *newIndex,i,start,end;
+  struct grid *oldGp;
+  int j,si;
+
+  if(par->gridOrdering==GRID_ORDER_NONE)
+    return;
+
+  keys     = malloc(sizeof(*keys)    *numPoints);
+  newIndex = malloc(sizeof(*newIndex)*numPoints);
+
+  for(i=0;i<numPoints;i++){
+    keys[i].key = _curveKey(par->gridOrdering, gp[i].x, par->radius);
+    keys[i].index = i;
+  }
+
+  for(si=0;si<2;si++){
+    start = (si==0) ? 0 : (unsigned long)par->pIntensity;
+    end   = (si==0) ? (unsigned long)par->pIntensity : numPoints;
+    if(end>start)
+      qsort(keys+start, end-start, sizeof(*keys), _compareCurveKeys);
+  }
+
+  for(i=0;i<numPoints;i++)
+    newIndex[keys[i].index] = i;
+  free(keys);
+
+  oldGp = malloc(sizeof(*oldGp)*numPoints);
+  memcpy(oldGp, gp, sizeof(*oldGp)*numPoints);
+  for(i=0;i<numPoints;i++){
+    gp[newIndex[i]] = oldGp[i];
+    gp[newIndex[i]].id = (int)newIndex[i];
+  }
+  free(oldGp);
+
+  /* The .neigh pointers still hold the old addresses, from which we get the old indices. */
+  for(i=0;i<numPoints;i++){
+    for(j=0;j<gp[i].numNeigh;j++)
+      gp[i].neigh[j] = &gp[newIndex[gp[i].neigh[j]-gp]];
+  }
+
+  if(dc!=NULL){
+    for(i=0;i<numCells;i++){
+      for(j=0;j<DIM+1;j++)
+        dc[i].vertx[j] = &gp[newIndex[dc[i].vertx[j]-gp]];
+    }
+  }
+
+  free(newIndex);
+
+  par->gridOrderingDone = par->gridOrdering;
+}
+
+/*....................................................................*/
+void
+buildNeighGraph(const unsigned long numPoints, struct grid *gp, const int nThreads){
+  /*
+Packs the neighbour information of all the grid points into a single struct neighGraph and calculates the link vectors and lengths. Rather than a separate set of small mallocs for each point, the graph uses one array per quantity for the whole grid, so that the links of successive points lie next to each other in memory; and the hot loops of the solver and raytracer can use the 32-bit neighbour indices and float unit vectors, which take much less cache than the pointers and double-precision struct point entries.
+
+The .neigh, .dir and .ds fields of each point are set to point into the graph, so code which uses them still works. The grid points must be stored at indices equal to their .id values. The links of different points are independent, so they are shared out among nThreads threads.
+  */
+  struct neighGraph *graph,*oldGraph;
+  long i;
+  unsigned long li;
+  int k,l;
+  double startTime=omp_get_wtime();
+
+  graph = malloc(sizeof(*graph));
+  graph->numPoints = numPoints;
+  graph->firstLink = malloc(sizeof(*graph->firstLink)*(numPoints+1));
+  li = 0;
+  for(i=0;i<(long)numPoints;i++){
+    graph->firstLink[i] = li;
+    li += (unsigned long)gp[i].numNeigh;
+  }
+  graph->firstLink[numPoints] = li;
+  graph->numLinks = li;
+
+  graph->neighI = malloc(sizeof(*graph->neighI)*graph->numLinks);
+  graph->xn     = malloc(sizeof(*graph->xn)    *graph->numLinks);
+  graph->ds     = malloc(sizeof(*graph->ds)    *graph->numLinks);
+  graph->dir    = malloc(sizeof(*graph->dir)   *graph->numLinks);
+  graph->neigh  = malloc(sizeof(*graph->neigh) *graph->numLinks);
+
+#pragma omp parallel for private(k,l,li) num_threads(nThreads) schedule(static)
+  for(i=0;i<(long)numPoints;i++){
     for(k=0;k<gp[i].numNeigh;k++){
-      for(l=0;l<3;l++)
-        gp[i].dir[k].x[l] = gp[i].neigh[k]->x[l] - gp[i].x[l];
+      li = graph->firstLink[i] + k;
+      graph->neigh[li]  = gp[i].neigh[k];
+      graph->neighI[li] = (unsigned int)(gp[i].neigh[k] - gp);
+
+      for(l=0;l<DIM;l++)
+        graph->dir[li].x[l] = gp[i].neigh[k]->x[l] - gp[i].x[l];
 
-      gp[i].ds[k] = sqrt(  gp[i].dir[k].x[0]*gp[i].dir[k].x[0]\
-                         + gp[i].dir[k].x[1]*gp[i].dir[k].x[1]\
-                         + gp[i].dir[k].x[2]*gp[i].dir[k].x[2]);
+      graph->ds[li] = sqrt(  graph->dir[li].x[0]*graph->dir[li].x[0]\
+                           + graph->dir[li].x[1]*graph->dir[li].x[1]\
+                           + graph->dir[li].x[2]*graph->dir[li].x[2]);
 
-      for(l=0;l<3;l++)
-        gp[i].dir[k].xn[l] = gp[i].dir[k].x[l]/gp[i].ds[k];
+      for(l=0;l<DIM;l++){
+        graph->dir[li].xn[l] = graph->dir[li].x[l]/graph->ds[li];
+        graph->xn[li][l] = (float)graph->dir[li].xn[l];
+      }
     }
-    gp[i].nphot=RAYS_PER_POINT;
   }
+
+  oldGraph = (numPoints>0) ? gp[0].graph : NULL;
+#pragma omp parallel for num_threads(nThreads) schedule(static)
+  for(i=0;i<(long)numPoints;i++){
+    if(gp[i].graph==NULL){
+      free(gp[i].neigh);
+      free(gp[i].dir);
+      free(gp[i].ds);
+    }
+    gp[i].neigh = graph->neigh + graph->firstLink[i];
+    gp[i].dir   = graph->dir   + graph->firstLink[i];
+    gp[i].ds    = graph->ds    + graph->firstLink[i];
+    gp[i].graph = graph;
+  }
+  freeNeighGraph(oldGraph);
+  addPrepTime(PREP_NEIGH_GRAPH, omp_get_wtime()-startTime);
+}
+
+/*....................................................................*/
+void
+unpackNeighGraph(const unsigned long numPoints, struct grid *gp){
+  /*
+Reverses buildNeighGraph(), giving each grid point its own malloc'd copies of .neigh, .dir and .ds. This is needed before anything which reallocates these point by point.
+  */
+  struct neighGraph *graph;
+  unsigned long i;
+  int n,k,l;
+
+  if(numPoints==0 || gp[0].graph==NULL)
+return;
+
+  graph = gp[0].graph;
+  for(i=0;i<numPoints;i++){
+    n = gp[i].numNeigh;
+    gp[i].neigh = malloc(sizeof(*gp[i].neigh)*n);
+    gp[i].dir   = malloc(sizeof(*gp[i].dir)  *n);
+    gp[i].ds    = malloc(sizeof(*gp[i].ds)   *n);
+    memcpy(gp[i].neigh, graph->neigh + graph->firstLink[i], sizeof(*gp[i].neigh)*n);
+    if(graph->dir!=NULL)
+      memcpy(gp[i].dir, graph->dir + graph->firstLink[i], sizeof(*gp[i].dir)*n);
+    else{ /* freeNeighGraphDirs() has been called. */
+      for(k=0;k<n;k++){
+        for(l=0;l<DIM;l++){
+          gp[i].dir[k].x[l]  = gp[i].neigh[k]->x[l] - gp[i].x[l];
+          gp[i].dir[k].xn[l] = gp[i].dir[k].x[l]/graph->ds[graph->firstLink[i]+k];
+        }
+      }
+    }
+    memcpy(gp[i].ds,    graph->ds    + graph->firstLink[i], sizeof(*gp[i].ds)   *n);
+    gp[i].graph = NULL;
+  }
+  freeNeighGraph(graph);
+}
+
+/*....................................................................*/
+int
+colourNeighGraph(const unsigned long numPoints, struct grid *gp, int *colour){
+  /*
+Gives each non-sink grid point a colour, numbered from 0, such that no two neighbouring non-sink points have the same colour; the sink points get colour -1. The return value is the number of colours. The points are coloured greedily in order of index, each getting the lowest colour not already taken by one of its neighbours, so that if the grid has been ordered along a space-filling curve, the points of each colour are spread fairly evenly through the model. At most one more colour is needed than the largest number of neighbours of any point. The grid points must be stored at indices equal to their .id values.
+  */
+  unsigned long i;
+  int k,c,numColours=0,maxNumNeigh=0;
+  unsigned long *taken; /* taken[c]==i+1 if colour c is used by a neighbour of point i. */
+
+  for(i=0;i<numPoints;i++)
+    if(gp[i].numNeigh>maxNumNeigh) maxNumNeigh = gp[i].numNeigh;
+
+  taken = calloc(maxNumNeigh+1, sizeof(*taken));
+  for(i=0;i<numPoints;i++)
+    colour[i] = -1;
+
+  for(i=0;i<numPoints;i++){
+    if(gp[i].sink)
+  continue;
+
+    for(k=0;k<gp[i].numNeigh;k++){
+      c = colour[gp[i].neigh[k]->id];
+      if(c>=0) taken[c] = i+1;
+    }
+    for(c=0;taken[c]==i+1;c++);
+    colour[i] = c;
+    if(c+1>numColours) numColours = c+1;
+  }
+
+  free(taken);
+
+return numColours;
+}
+
+/*....................................................................*/
+void distCalc(configInfo *par, struct grid *gp){
+  int i;
+
+  buildNeighGraph((unsigned long)par->ncell, gp, par->nThreads); /* Sets .dir & .ds. */
+  for(i=0;i<par->ncell;i++)
+    gp[i].nphot=RAYS_PER_POINT;
 }
 
 
@@ -514,7 +851,7 @@ getEdgeVelocities(configInfo *par, struct grid *gp){
 
 /*....................................................................*/
 int setupAndWriteGrid(configInfo *par, struct grid *gp, molData *md, char *outFileName){
-  const int numKwds=3;
+  const int numKwds=5;
   int i,status = 0;
   struct gridInfoType gridInfo;
   unsigned short i_us;
@@ -560,6 +897,20 @@ int setupAndWriteGrid(configInfo *par, struct grid *gp, molData *md, char *outFi
   primaryKwds[i].intValue = par->nSolveItersDone;
   sprintf(primaryKwds[i].comment, "Number of RTE iterations performed.");
 
+  i++;
+  initializeKeyword(&primaryKwds[i]);
+  primaryKwds[i].datatype = lime_INT;
+  sprintf(primaryKwds[i].keyname, "CONVERGD");
+  primaryKwds[i].intValue = (int)par->solverConverged;
+  sprintf(primaryKwds[i].comment, "1 if RTE stopped by convergence criteria.");
+
+  i++;
+  initializeKeyword(&primaryKwds[i]);
+  primaryKwds[i].datatype = lime_INT;
+  sprintf(primaryKwds[i].keyname, "GRIDORDR");
+  primaryKwds[i].intValue = par->gridOrderingDone;
+  sprintf(primaryKwds[i].comment, "Point order: 0 as generated, 1 Morton, 2 Hilbert.");
+
   status = writeGrid(outFileName\
     , gridInfo, primaryKwds, numKwds, gp, par->collPartNames, par->dataFlags);
 
@@ -239,6 +239,8 @@ exit(1);
   }
   fclose(fp);
 
+  par.nThreads = 1; /* The grid_aux.c passes read this. */
+
   if(arguments.fitsIsTheInput){
     int numCollPartRead=0,dataFlags=0,i;
     char **collPartNames;
@@ -284,6 +286,7 @@ exit(1);
       par.collPartIds = NULL;
       par.numDensities = 1;
       par.lte_only = 0;
+      par.lvg_only = 0;
       par.binoutputfile = arguments.outFile;
       par.radius = arguments.modelRadius;
       par.nMolWeights = malloc(sizeof(*par.nMolWeights)*par.nSpecies);
@@ -116,6 +116,18 @@ openFileForWrite(char *outFileName){
 }
 
 
+/*....................................................................*/
+unsigned int
+_getNeighId(struct grid *gp, const unsigned int gi, const int j){
+  /* Returns the id of the jth neighbour of grid point gi, from the neighbour graph if this has been built. */
+  const struct neighGraph *graph=gp[gi].graph;
+
+  if(graph!=NULL)
+    return (unsigned int)gp[graph->neighI[graph->firstLink[gi]+j]].id;
+  else
+    return (unsigned int)gp[gi].neigh[j]->id;
+}
+
 /*....................................................................*/
 void
 constructLinkArrays(struct gridInfoType gridInfo, struct grid *gp, struct linkType **links\
@@ -162,14 +174,14 @@ See the comment at the beginning of the present module for a description of how
     for(jA=0;jA<gAPtr->numNeigh;jA++){
       /* Check to see if the NN has been done.
       */
-      gBPtr = gAPtr->neigh[jA];
-      idB = gBPtr->id;
+      idB = _getNeighId(gp, i_ui, jA);
+      gBPtr = &gp[idB];
       if(pointIsDone[idB]){
         /* The link exists; we need to find a pointer to it for the next entry of nnLinks. To do that, we need to go through the list of NN links of the point whose id is idB and identify that link which connects back to idA.
         */
         linkNotFound = 1; /* default */
         for(jB=0;jB<gBPtr->numNeigh;jB++){
-          trialIdA = gBPtr->neigh[jB]->id;
+          trialIdA = _getNeighId(gp, idB, jB);
           if(trialIdA==idA){
             linkNotFound = 0;
             k = (*firstNearNeigh)[idB] + jB;
@@ -230,7 +242,7 @@ We want to read in the intra-edge velocity samples which are currently still bei
         /* Find which neighbour of gAPtr corresponds to the link: */
         linkNotFound = 1;
         for(jA=0;jA<gAPtr->numNeigh;jA++){
-          idB = gAPtr->neigh[jA]->id;
+          idB = _getNeighId(gp, (*links)[i_ui].gis[nearI], jA);
           if(linkNotFound && idB==(*links)[i_ui].gis[1-nearI]){
             if(nearI==0){
               for(j_us=0;j_us<gridInfo.nDims;j_us++){
@@ -992,6 +1004,11 @@ exit(1);
       warning("Your choice of LTE calculation will erase the RTE solution you read from file.");
   }
 
+  if(par->nSolveItersDone>0 && (par->init_lvg || par->lvg_only)){
+    if(!silent)
+      warning("Your choice of LVG calculation will erase the RTE solution you read from file.");
+  }
+
   if(allBitsSet(par->dataFlags, DS_mask_populations) && par->nSolveItersDone<=0){
     if(!silent)
       bail_out("Populations were read but par->nSolveItersDone<=0.");
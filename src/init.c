@@ -34,6 +34,30 @@ The parameters visible to the user have now been strictly confined to members of
   par->traceRayAlgorithm = inpars.traceRayAlgorithm;
   par->resetRNG          = inpars.resetRNG;
   par->doSolveRTE        = inpars.doSolveRTE;
+  par->doNgAccel         = inpars.doNgAccel;
+  par->convMedianSNR     = inpars.convMedianSNR;
+  par->convFracConverged = inpars.convFracConverged;
+  par->convMaxRelChange  = inpars.convMaxRelChange;
+  par->freezeTol         = inpars.freezeTol;
+  par->freezeRefresh     = inpars.freezeRefresh;
+  par->pathCacheMB       = inpars.pathCacheMB;
+  par->jbarSampling      = inpars.jbarSampling;
+  par->nPhotMin          = inpars.nPhotMin;
+  par->nPhotMax          = inpars.nPhotMax;
+  par->lineKernel        = inpars.lineKernel;
+  par->statEqSolver      = inpars.statEqSolver;
+  par->collCacheMB       = inpars.collCacheMB;
+  par->rngType           = inpars.rngType;
+  par->solverSchedule    = inpars.solverSchedule;
+  par->gridOrdering      = inpars.gridOrdering;
+  par->mixedPrecision    = inpars.mixedPrecision;
+  par->minPhotonExpTau   = inpars.minPhotonExpTau;
+  par->aliSchedule       = inpars.aliSchedule;
+  par->aliMinIters       = inpars.aliMinIters;
+  par->solverUpdate      = inpars.solverUpdate;
+  par->multigridLevels   = inpars.multigridLevels;
+  par->lvg_only          = inpars.lvg_only;
+  par->init_lvg          = inpars.init_lvg;
 
   /* Somewhat more carefully copy over the strings:
   */
@@ -170,6 +194,10 @@ Harder things which we will calculate and set later:
   par->minScaleSqu=par->minScale*par->minScale;
   par->doPregrid = (par->pregrid==NULL)?0:1;
   par->nSolveItersDone = 0; /* This can be set to some non-zero value if the user reads in a grid file at dataStageI==5. */
+  par->solverConverged = 0;
+  par->gridOrderingDone = GRID_ORDER_NONE; /* Set by reorderGridAlongCurve(). */
+  par->nPhotonSteps = 0.0; /* Added to by levelPops(). */
+  par->nPhotonStepsCoarse = 0.0; /* Set by multigridInitPops(). */
   par->useAbun = 1; /* Can be unset within readOrBuildGrid(). */
   par->dataFlags = 0; /* default */
   par->numDensities = 0; /* default */
@@ -379,6 +407,83 @@ exit(1);
     }
   }
 
+  if(par->jbarSampling<0 || par->jbarSampling>1){
+    if(!silent) bail_out("par->jbarSampling must be 0 (random) or 1 (quasi-random).");
+exit(1);
+  }
+
+  if(par->lineKernel<0 || par->lineKernel>1){
+    if(!silent) bail_out("par->lineKernel must be 0 (scalar) or 1 (SoA).");
+exit(1);
+  }
+
+  if(par->statEqSolver<0 || par->statEqSolver>2){
+    if(!silent) bail_out("par->statEqSolver must be 0 (automatic), 1 (dense LU) or 2 (sparse).");
+exit(1);
+  }
+
+  if(par->rngType!=RNG_RANLXS2 && par->rngType!=RNG_PHILOX){
+    if(!silent) bail_out("par->rngType must be 0 (ranlxs2) or 1 (Philox).");
+exit(1);
+  }
+
+  if(par->solverSchedule<0 || par->solverSchedule>2){
+    if(!silent) bail_out("par->solverSchedule must be 0 (automatic), 1 (static) or 2 (cost-ordered).");
+exit(1);
+  }
+  if(par->solverSchedule==2 && par->rngType!=RNG_PHILOX && par->nThreads>1 && !silent)
+    warning("With par->solverSchedule=2 and par->rngType=0, results will vary between runs.");
+
+  if(par->gridOrdering<GRID_ORDER_NONE || par->gridOrdering>GRID_ORDER_HILBERT){
+    if(!silent) bail_out("par->gridOrdering must be 0 (none), 1 (Morton) or 2 (Hilbert).");
+exit(1);
+  }
+
+  if(par->minPhotonExpTau<0.0 || par->minPhotonExpTau>=1.0){
+    if(!silent) bail_out("par->minPhotonExpTau must be >=0 and <1.");
+exit(1);
+  }
+
+  if(par->aliSchedule<0 || par->aliSchedule>1){
+    if(!silent) bail_out("par->aliSchedule must be 0 (fixed) or 1 (adaptive).");
+exit(1);
+  }
+
+  if(par->aliMinIters<1 || par->aliMinIters>MAXITER){
+    if(!silent){
+      snprintf(message, STR_LEN_1, "Need 1<=par->aliMinIters<=%d.", MAXITER);
+      bail_out(message);
+    }
+exit(1);
+  }
+
+  if(par->solverUpdate!=SOLVER_UPDATE_JACOBI && par->solverUpdate!=SOLVER_UPDATE_COLOURS){
+    if(!silent) bail_out("par->solverUpdate must be 0 (Jacobi) or 1 (by colours).");
+exit(1);
+  }
+
+  if(par->multigridLevels<0 || par->multigridLevels>MULTIGRID_MAX_LEVELS){
+    if(!silent){
+      snprintf(message, STR_LEN_1, "par->multigridLevels must be between 0 and %d.", MULTIGRID_MAX_LEVELS);
+      bail_out(message);
+    }
+exit(1);
+  }
+
+  if(par->multigridLevels>0 && par->convMedianSNR<=0.0 && par->convFracConverged<=0.0 && par->convMaxRelChange<=0.0 && !silent)
+    warning("Without any of the convergence criteria par->conv*, par->multigridLevels>0 saves no iterations on the full grid.");
+
+  if(par->nPhotMax>0){
+    /* The total number of photons per iteration is kept at par->pIntensity*RAYS_PER_POINT, so this must be attainable. */
+    if(par->nPhotMin<1 || par->nPhotMin>RAYS_PER_POINT || par->nPhotMax<RAYS_PER_POINT || par->nPhotMax>MAX_RAYS_PER_POINT){
+      if(!silent){
+        snprintf(message, STR_LEN_1, "Need 1<=par->nPhotMin<=%d<=par->nPhotMax<=%d.", RAYS_PER_POINT, MAX_RAYS_PER_POINT);
+        bail_out(message);
+      }
+exit(1);
+    }
+  }
+
 }
 
 /*....................................................................*/
@@ -483,7 +588,7 @@ calcGridDensGlobalMax(configInfo *par){
 
   int i,j;
   double tempPointDensity,r[3];
-  const gsl_rng_type *ranNumGenType = gsl_rng_ranlxs2;
+  const gsl_rng_type *ranNumGenType = rngTypeFromPar(par->rngType);
   gsl_rng *randGen;
   _Bool foundGoodValue;
 
@@ -826,15 +931,29 @@ exit(1);
 
   par->edgeVelsAvailable=0; /* default value, this is set within getEdgeVelocities(). */
 
+  if(par->lte_only && par->lvg_only){
+    if(!silent) bail_out("You cannot set both par->lte_only and par->lvg_only.");
+exit(1);
+  }
+
   if(!silent){
     if(par->lte_only && par->nSolveIters>0)
       warning("Requesting par->nSolveIters>0 will have no effect if LTE calculation is also requested.");
 
+    if(par->lvg_only && par->nSolveIters>0)
+      warning("Requesting par->nSolveIters>0 will have no effect if LVG calculation is also requested.");
+
     if(allBitsSet(par->dataFlags, DS_mask_populations) && par->lte_only)
       warning("LTE calculation will overwrite the population values read from file.");
+
+    if(allBitsSet(par->dataFlags, DS_mask_populations) && par->lvg_only)
+      warning("LVG calculation will overwrite the population values read from file.");
+
+    if(par->init_lte && par->init_lvg)
+      warning("Both par->init_lte and par->init_lvg are set; LTE starting values will be used.");
   }
 
-  if(par->nSolveIters>par->nSolveItersDone || par->lte_only) /* To save the user having to set par->doSolveRTE as well as par->nSolveIters>0 or par->lte_only. */
+  if(par->nSolveIters>par->nSolveItersDone || par->lte_only || par->lvg_only) /* To save the user having to set par->doSolveRTE as well as par->nSolveIters>0 or par->lte_only. */
     par->doSolveRTE = TRUE;
 
   if(allBitsSet(par->dataFlags, DS_mask_populations))
@@ -863,6 +982,9 @@ exit(1);
   if(!silent && !par->doMolCalcs && par->init_lte)
     warning("Your choice of par->init_lte will have no effect.");
 
+  if(!silent && !par->doMolCalcs && par->init_lvg)
+    warning("Your choice of par->init_lvg will have no effect.");
+
   if(par->nSpecies>0 && !par->doMolCalcs){
     if(!silent) bail_out("If you want only continuum calculations you must supply zero moldatfiles.");
 exit(1);
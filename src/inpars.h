@@ -15,12 +15,14 @@
 typedef struct {
   double radius,minScale,tcmb,*nMolWeights,*dustWeights;
   double (*gridDensMaxLoc)[DIM],*gridDensMaxValues,*collPartMolWeights;
+  double convMedianSNR,convFracConverged,convMaxRelChange,freezeTol,pathCacheMB,collCacheMB,minPhotonExpTau;
   int sinkPoints,pIntensity,blend,*collPartIds,traceRayAlgorithm,samplingAlgorithm;
   int sampling,lte_only,init_lte,antialias,polarization,nThreads,nSolveIters;
+  int freezeRefresh,jbarSampling,nPhotMin,nPhotMax,lineKernel,statEqSolver,rngType,solverSchedule,gridOrdering,aliSchedule,aliMinIters,solverUpdate,multigridLevels,lvg_only,init_lvg;
   char **girdatfile,**moldatfile,**collPartNames;
   char *outputfile,*binoutputfile,*gridfile,*pregrid,*restart,*dust;
   char *gridInFile,**gridOutFiles;
-  _Bool resetRNG,doSolveRTE;
+  _Bool resetRNG,doSolveRTE,doNgAccel,mixedPrecision;
 } inputPars;
 
 /* Image information */
@@ -33,6 +33,10 @@
 #define omp_get_num_threads() 0
 #define omp_get_thread_num() 0
 #define omp_set_dynamic(int) 0
+#define omp_set_schedule(kind,chunk) ((void)0)
+#define omp_sched_static 1
+#define omp_sched_dynamic 2
+#define omp_get_wtime() ((double)clock()/CLOCKS_PER_SEC)
 #endif
 
 #include "dims.h"
@@ -55,6 +59,7 @@
 #define IMG_MIN_ALLOWED         1.0e-30
 #define TOL                     1e-6
 #define MAXITER                 50
+#define LVG_MAXITER             200                    /* Max. number of passes of the escape-probability (LVG) solution at each point. */
 #define maxBlendDeltaV          1.e4                   /* m/s */
 #define N_RAN_PER_SEGMENT       3
 #define FAST_EXP_MAX_TAYLOR     3
@@ -69,6 +74,14 @@
 #define NUM_VEL_COEFFS          (1+2*N_VEL_SEG_PER_HALF) /* This is the number of velocity samples per edge (not including the grid vertices at each end of the edge). Currently this is elsewhere hard-wired at 3, the macro just being used in the file I/O modules. Note that we want an odd number of velocity samples per edge if we want to have the ability to do 2nd-order interpolation of velocity within Delaunay tetrahedra. */
 #define MAX_NEG_OPT_DEPTH	30.0			/* 30 was the original value in LIME. */
 #define NUM_RAN_DENS		100
+#define NG_ACCEL_PERIOD		4			/* Number of solution iterations between Ng extrapolations. */
+#define FREEZE_NEIGH_FACTOR	10.0			/* A frozen grid point is re-activated if a neighbour's populations change by more than this times par->freezeTol. */
+#define STATEQ_SPARSE_MIN_NLEV	100			/* With par->statEqSolver==0, species with fewer levels than this use dense LU... */
+#define STATEQ_SPARSE_MAX_BAND	0.2			/* ...as do those for which the band half-width of the rate matrix is more than this fraction of the number of levels. */
+#define SOLVER_DYNAMIC_CHUNK	16			/* Grid points per chunk when the solver loop is scheduled dynamically. */
+#define ALI_TOL_MAX		1e-2			/* With par->aliSchedule==1, the ALI tolerance in the first iteration... */
+#define ALI_TOL_SNR_FACTOR	10.0			/* ...and thereafter 1/(this times the median SNR of the populations), but not less than TOL. */
+#define ALI_MIN_ITERS_EARLY	2			/* With par->aliSchedule==1, at most this many ALI iterations are mandatory while the tolerance is looser than TOL. */
 
 /* Bit locations for the grid data-stage mask, that records the information which is present in the grid struct: */
 #define DS_bit_x             0	/* id, x, sink */
@@ -101,6 +114,29 @@
 #define DS_mask_all          (DS_mask_populations | DS_mask_magfield)
 #define DS_mask_all_but_mag  DS_mask_all & ~(1<<DS_bit_magfield)
 
+/* Values of par->gridOrdering: */
+#define GRID_ORDER_NONE      0
+#define GRID_ORDER_MORTON    1
+#define GRID_ORDER_HILBERT   2
+
+/* Values of par->solverUpdate: */
+#define SOLVER_UPDATE_JACOBI  0
+#define SOLVER_UPDATE_COLOURS 1
+
+/* Coarse grids for par->multigridLevels>0: coarse grid L has every MULTIGRID_STRIDE^L-th point of the full grid, and is only used if it has at least MULTIGRID_MIN_POINTS non-sink points. Each coarse grid is given at most MULTIGRID_COARSE_ITERS solution iterations. */
+#define MULTIGRID_STRIDE      8
+#define MULTIGRID_MIN_POINTS  100
+#define MULTIGRID_MAX_LEVELS  4
+#define MULTIGRID_COARSE_ITERS 8
+
+/* The per-grid-point preprocessing passes timed by addPrepTime(): */
+#define PREP_NEIGH_GRAPH      0
+#define PREP_CHECK_DENS       1
+#define PREP_MOL_VALUES       2
+#define PREP_SPEC_NUM_DENS    3
+#define PREP_DUST_OPACITY     4
+#define NUM_PREP_PASSES       5
+
 
 #include "ufunc_types.h" /* includes lime_config.h */
 #include "collparts.h"
@@ -108,6 +144,7 @@
 #include "defaults.h" /* includes lime_config.h */
 #include "messages.h"
 #include "aux.h"
+#include "rng.h"
 
 struct cpData {
   double *down,*temp;
@@ -146,6 +183,17 @@ struct populations {
   struct continuumLine *cont;
 };
 
+/* The Delaunay links of the whole grid in compressed-sparse-row form. The links of grid point i are entries firstLink[i] to firstLink[i+1]-1 of the other arrays, in the same order as the .neigh, .dir and .ds entries of the point, which are pointers into the same storage.
+*/
+struct neighGraph {
+  unsigned long numPoints,numLinks,*firstLink;
+  unsigned int *neighI; /* Index of the grid point at the far end of the link. */
+  float (*xn)[DIM]; /* Unit vector along the link. */
+  double *ds; /* Length of the link. */
+  struct point *dir;
+  struct grid **neigh;
+};
+
 /* Grid properties */
 struct grid {
   int id;
@@ -162,6 +210,7 @@ struct grid {
   double *ds;
   struct populations *mol;
   struct continuumLine cont;
+  struct neighGraph *graph; /* The same for all points; NULL if .neigh, .dir and .ds are malloc'd point by point. */
 };
 
 /* NOTE that it is assumed that vertx[i] is opposite the face that abuts with neigh[i] for all i.
@@ -180,19 +229,23 @@ extern _Bool fixRandomSeeds;
 int	run(inputPars, image*, const int);
 int	run_new(inputPars, image*, const int);
 
+void	addPrepTime(const int, const double);
 void	binpopsout(configInfo*, struct grid*, molData*);
 void	buildGrid(configInfo*, struct grid**);
+void	buildNeighGraph(const unsigned long, struct grid*, const int);
 void	calcDustData(configInfo*, double*, double*, const double, double*, const int, const double ts[], double*, double*);
 void	calcExpTableEntries(const int, const int);
 void	calcGridDensGlobalMax(configInfo *par);
 void	calcGridMolDensities(configInfo*, struct grid**);
 void	calcGridMolDoppler(configInfo*, molData*, struct grid*);
 void	calcGridMolSpecNumDens(configInfo*, molData*, struct grid*);
+void	calcGridMolValues(configInfo*, molData*, struct grid*);
 void	calcSourceFn(double, const configInfo*, double*, double*);
 void	checkFirstLineMolDat(FILE *fp, char *moldatfile);
 void	checkGridDensities(configInfo*, struct grid*);
 void	checkUserDensWeights(configInfo*);
 int	checkUserFunctions(configInfo *par, _Bool checkForSingularities);
+int	colourNeighGraph(const unsigned long, struct grid*, int*);
 int	copyInpars(const inputPars inpars, image *inimg, const int nImages, configInfo *par, imageInfo **img);
 void	delaunay(const int, struct grid*, const unsigned long, const _Bool, const _Bool, struct cell**, unsigned long*);
 void	distCalc(configInfo*, struct grid*);
@@ -204,6 +257,8 @@ void	freeGrid(const unsigned int, const unsigned short, struct grid*);
 void	freeImgInfo(const int, imageInfo*);
 void	freeInputPars(inputPars *par);
 void	freeMolData(const int, molData*);
+void	freeNeighGraph(struct neighGraph*);
+void	freeNeighGraphDirs(const unsigned long, struct grid*);
 void	freePopulation(const unsigned short, struct populations*);
 void	freeSomeGridFields(const unsigned int, const unsigned short, struct grid*);
 void	furtherParChecks(configInfo *par);
@@ -216,6 +271,7 @@ int	levelPops(molData*, configInfo*, struct grid*, int*, double*, double*, const
 void	mallocAndSetDefaultGrid(struct grid**, const size_t, const size_t);
 void	mallocAndSetDefaultMolData(const int, molData**);
 void	molInit(configInfo*, molData*);
+void	multigridInitPops(configInfo*, molData*, struct grid*, double*, double*, const int);
 void	openSocket(char*);
 void	parChecks(configInfo *par);
 void	parseImagePars(configInfo *par, imageInfo **img);
@@ -229,6 +285,9 @@ void	readDustFile(char*, double**, double**, int*);
 void	readGridWrapper(configInfo *par, struct grid **gp, char ***collPartNames, int *numCollPartRead);
 void	readMolData(configInfo *par, molData *md, int **allUniqueCollPartIds, int *numUniqueCollPartsFound);
 unsigned long reorderGrid(const unsigned long, struct grid*);
+void	reorderGridAlongCurve(configInfo*, struct grid*, struct cell*, const unsigned long);
+void	reportMultigridCost(configInfo*, const int);
+void	reportPrepTimes(void);
 void	setCollPartsDefaults(struct cpData*);
 void	setOtherEasyConfigValues(const int nImages, configInfo *par, imageInfo **img);
 int	setupAndWriteGrid(configInfo *par, struct grid *gp, molData *md, char *outFileName);
@@ -238,6 +297,7 @@ void	sourceFunc_line(const molData*, const double, const struct populations*, co
 void	sourceFunc_cont(const struct continuumLine, double*, double*);
 void	sourceFunc_pol(double*, const struct continuumLine, double (*rotMat)[3], double*, double*);
 void	specNumDensInit(configInfo *par, molData *md, struct grid *gp);
+void	unpackNeighGraph(const unsigned long, struct grid*);
 void	writeFitsAllUnits(const int, configInfo*, imageInfo*);
 void	writeGridIfRequired(configInfo*, struct grid*, molData*, const int);
 void	writeGridToAscii(char *outFileName, struct grid *gp, const unsigned int nInternalPoints, const int dataFlags);
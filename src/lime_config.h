@@ -22,21 +22,24 @@ typedef struct {
   /* Elements also present in struct inpars: */
   double radius,minScale,tcmb,*nMolWeights;
   double (*gridDensMaxLoc)[DIM],*gridDensMaxValues,*collPartMolWeights;
+  double convMedianSNR,convFracConverged,convMaxRelChange,freezeTol,pathCacheMB,collCacheMB,minPhotonExpTau;
   int sinkPoints,pIntensity,blend,*collPartIds,traceRayAlgorithm,samplingAlgorithm;
   int sampling,lte_only,init_lte,antialias,polarization,nThreads,nSolveIters;
+  int freezeRefresh,jbarSampling,nPhotMin,nPhotMax,lineKernel,statEqSolver,rngType,solverSchedule,gridOrdering,aliSchedule,aliMinIters,solverUpdate,multigridLevels,lvg_only,init_lvg;
   int collPartUserSetFlags;
   char **girdatfile,**moldatfile,**collPartNames;
   char *outputfile,*binoutputfile,*gridfile,*pregrid,*restart,*dust;
   char *gridInFile,**gridOutFiles;
-  _Bool resetRNG,doSolveRTE;
+  _Bool resetRNG,doSolveRTE,doNgAccel,mixedPrecision;
 
   /* New elements: */
-  double radiusSqu,minScaleSqu,taylorCutoff,gridDensGlobalMax;
+  double radiusSqu,minScaleSqu,taylorCutoff,gridDensGlobalMax,nPhotonSteps,nPhotonStepsCoarse;
   int ncell,nImages,nSpecies,numDensities,doPregrid,numGridDensMaxima,numDims;
-  int nLineImages,nContImages,dataFlags,nSolveItersDone;
+  int nLineImages,nContImages,dataFlags,nSolveItersDone,gridOrderingDone;
   _Bool doInterpolateVels,useAbun,doMolCalcs;
   _Bool writeGridAtStage[NUM_GRID_STAGES],useVelFuncInRaytrace,edgeVelsAvailable;
   _Bool needToInitPops,needToInitSND,SNDhasBeenInit,popsHasBeenInit;
+  _Bool solverConverged;
 } configInfo;
 
 struct spec {
@@ -73,6 +73,30 @@ initParImg(inputPars *par, image **img)
   par->traceRayAlgorithm=0;
   par->resetRNG=0;
   par->doSolveRTE=0;
+  par->doNgAccel=0;
+  par->convMedianSNR=0.0;
+  par->convFracConverged=0.0;
+  par->convMaxRelChange=0.0;
+  par->freezeTol=0.0;
+  par->freezeRefresh=5;
+  par->pathCacheMB=0.0;
+  par->jbarSampling=0;
+  par->nPhotMin=0;
+  par->nPhotMax=0;
+  par->lineKernel=1;
+  par->statEqSolver=0;
+  par->collCacheMB=0.0;
+  par->rngType=0;
+  par->solverSchedule=0;
+  par->gridOrdering=0;
+  par->mixedPrecision=0;
+  par->minPhotonExpTau=0.0;
+  par->aliSchedule=0;
+  par->aliMinIters=5;
+  par->solverUpdate=0;
+  par->multigridLevels=0;
+  par->lvg_only=0;
+  par->init_lvg=0;
 
   par->gridOutFiles = malloc(sizeof(char *)*NUM_GRID_STAGES);
   for(i=0;i<NUM_GRID_STAGES;i++)
@@ -0,0 +1,241 @@
+/*
+ *  multigrid.c
+ *  This file is part of LIME, the versatile line modeling engine
+ *
+ *  See ../COPYRIGHT
+ *
+ */
+
+#include "lime.h"
+
+/*
+Coarse-to-fine initialization of the level populations, for par->multigridLevels>0.
+
+In the first few iterations of the non-LTE solution on a large grid, most of the work goes into carrying radiation over distances of many grid cells, which the solution can only do a few cells at a time. The same thing can be done much more cheaply on a coarser grid. Coarse grid number L (L=1 to par->multigridLevels) is made from every MULTIGRID_STRIDE^L-th point of the full grid, non-sink and sink points separately, and the model functions are sampled at its points in the same way as for the full grid by buildGrid(). Since the point subsets are nested, each point of a coarse grid is also a point of all the finer ones. The coarsest grid is solved first, from the usual starting populations; the populations of each grid after its solution are then copied to the same points of the next finer one and spread from there to the rest of its points via its Delaunay links, and so on until the full grid is reached.
+*/
+
+struct pointKey{
+  double x[DIM];
+  int index;
+};
+
+/*....................................................................*/
+int
+_comparePointKeys(const void *a, const void *b){
+  const struct pointKey *ka=(const struct pointKey*)a,*kb=(const struct pointKey*)b;
+  int di;
+
+  for(di=0;di<DIM;di++){
+    if(ka->x[di]<kb->x[di]) return -1;
+    if(ka->x[di]>kb->x[di]) return  1;
+  }
+  return 0;
+}
+
+/*....................................................................*/
+void
+_makeCoarseGrid(configInfo *par, molData *md, struct grid *gp, const int stride\
+  , configInfo *cpar, struct grid **cgp, int **fineIndex){
+  /*
+Builds the coarse grid made of every stride-th non-sink and every stride-th sink point of the full grid gp. The coarse configuration cpar is a copy of par, with the numbers of points changed, the number of solution iterations limited to MULTIGRID_COARSE_ITERS, and the writing of grid and population files switched off; its pointer fields are shared with par, so it must not be freed. On return, (*fineIndex)[i] is the index in gp of coarse point i. This has to be found after the coarse grid is built, since buildGrid() renumbers the points.
+  */
+  int i,ci,numNonSinks,numSinks;
+  struct pointKey *keys,key,*match;
+
+  numNonSinks = (par->pIntensity+stride-1)/stride;
+  numSinks    = (par->sinkPoints+stride-1)/stride;
+
+  *cpar = *par;
+  cpar->pIntensity = numNonSinks;
+  cpar->sinkPoints = numSinks;
+  cpar->ncell      = numNonSinks + numSinks;
+  cpar->dataFlags  = DS_mask_1;
+  cpar->nSolveItersDone = 0;
+  cpar->nSolveIters = (par->nSolveIters<MULTIGRID_COARSE_ITERS) ? par->nSolveIters : MULTIGRID_COARSE_ITERS;
+  cpar->nPhotonSteps = 0.0;
+  cpar->gridfile      = NULL;
+  cpar->outputfile    = NULL;
+  cpar->binoutputfile = NULL;
+  for(i=0;i<NUM_GRID_STAGES;i++)
+    cpar->writeGridAtStage[i] = 0;
+
+  keys = malloc(sizeof(*keys)*cpar->ncell);
+  mallocAndSetDefaultGrid(cgp, (size_t)cpar->ncell, (size_t)cpar->nSpecies);
+  ci = 0;
+  for(i=0;i<par->pIntensity;i+=stride){
+    (*cgp)[ci].sink = 0;
+    keys[ci].index = i;
+    ci++;
+  }
+  for(i=par->pIntensity;i<par->ncell;i+=stride){
+    (*cgp)[ci].sink = 1;
+    keys[ci].index = i;
+    ci++;
+  }
+  for(ci=0;ci<cpar->ncell;ci++){
+    (*cgp)[ci].id = ci;
+    memcpy((*cgp)[ci].x, gp[keys[ci].index].x, sizeof((*cgp)[ci].x));
+    memcpy(keys[ci].x,   gp[keys[ci].index].x, sizeof(keys[ci].x));
+  }
+
+  buildGrid(cpar, cgp);
+
+  if(cpar->doMolCalcs)
+    calcGridMolValues(cpar, md, *cgp);
+  gridPopsInit(cpar, md, *cgp);
+  specNumDensInit(cpar, md, *cgp);
+
+  qsort(keys, (size_t)cpar->ncell, sizeof(*keys), _comparePointKeys);
+  *fineIndex = malloc(sizeof(**fineIndex)*cpar->ncell);
+  for(ci=0;ci<cpar->ncell;ci++){
+    memcpy(key.x, (*cgp)[ci].x, sizeof(key.x));
+    match = bsearch(&key, keys, (size_t)cpar->ncell, sizeof(*keys), _comparePointKeys);
+    (*fineIndex)[ci] = (match!=NULL) ? match->index : -1;
+  }
+
+  free(keys);
+}
+
+/*....................................................................*/
+void
+_prolongPops(configInfo *par, molData *md, struct grid *cgp, const int numCoarse\
+  , const int *targetIndex, struct grid *gp){
+  /*
+Copies the populations of the numCoarse non-sink points of the coarse grid cgp to the points targetIndex[i] of the finer grid gp (those with targetIndex[i]<0 being skipped), then fills in the rest of the non-sink points of gp in waves: at each wave, every point not yet filled but with at least one filled neighbour is given the average of the populations of those neighbours, weighted by the inverse of the link length. Since the populations of each species sum to 1, so do these averages. Points which cannot be reached in this way keep the populations they had.
+  */
+  int i,k,ispec,ilev,wave,numNew,ni,*filled;
+  double weight,sumWeights;
+
+  filled = calloc(par->pIntensity, sizeof(*filled)); /* filled[i] is the wave at which point i was filled, or 0. */
+
+  for(i=0;i<numCoarse;i++){
+    if(targetIndex[i]<0 || targetIndex[i]>=par->pIntensity)
+  continue;
+
+    for(ispec=0;ispec<par->nSpecies;ispec++)
+      memcpy(gp[targetIndex[i]].mol[ispec].pops, cgp[i].mol[ispec].pops, sizeof(double)*md[ispec].nlev);
+    filled[targetIndex[i]] = 1;
+  }
+
+  wave = 1;
+  do{
+    numNew = 0;
+    for(i=0;i<par->pIntensity;i++){
+      if(filled[i])
+    continue;
+
+      sumWeights = 0.0;
+      for(k=0;k<gp[i].numNeigh;k++){
+        ni = gp[i].neigh[k]->id;
+        if(ni<par->pIntensity && filled[ni]>0 && filled[ni]<=wave)
+          sumWeights += 1.0/gp[i].ds[k];
+      }
+      if(sumWeights<=0.0)
+    continue;
+
+      for(ispec=0;ispec<par->nSpecies;ispec++){
+        for(ilev=0;ilev<md[ispec].nlev;ilev++)
+          gp[i].mol[ispec].pops[ilev] = 0.0;
+        for(k=0;k<gp[i].numNeigh;k++){
+          ni = gp[i].neigh[k]->id;
+          if(ni<par->pIntensity && filled[ni]>0 && filled[ni]<=wave){
+            weight = 1.0/(gp[i].ds[k]*sumWeights);
+            for(ilev=0;ilev<md[ispec].nlev;ilev++)
+              gp[i].mol[ispec].pops[ilev] += weight*gp[ni].mol[ispec].pops[ilev];
+          }
+        }
+      }
+      filled[i] = wave+1;
+      numNew++;
+    }
+    wave++;
+  }while(numNew>0);
+
+  free(filled);
+}
+
+/*....................................................................*/
+void
+multigridInitPops(configInfo *par, molData *md, struct grid *gp\
+  , double *lamtab, double *kaptab, const int nEntries){
+  /*
+Sets the starting populations of the full grid gp by solving a sequence of coarser grids, as described at the top of this module. The grid must have its Delaunay links, and its populations must have been allocated by gridPopsInit(). Because the populations set here would otherwise be overwritten, par->init_lte and par->init_lvg are unset on return.
+  */
+  configInfo cpar,prevPar;
+  struct grid *cgp=NULL,*prevGp=NULL;
+  int *fineIndex=NULL,*prevFineIndex=NULL,*coarseOfFine=NULL,*targetIndex=NULL;
+  int level,stride,i,dummyPopsdone=0,nIters;
+  char message[STR_LEN_0];
+
+  par->nPhotonStepsCoarse = 0.0;
+  coarseOfFine = malloc(sizeof(*coarseOfFine)*par->ncell);
+
+  for(level=par->multigridLevels;level>=1;level--){
+    stride = 1;
+    for(i=0;i<level;i++)
+      stride *= MULTIGRID_STRIDE;
+    if(par->pIntensity/stride<MULTIGRID_MIN_POINTS)
+  continue;
+
+    _makeCoarseGrid(par, md, gp, stride, &cpar, &cgp, &fineIndex);
+
+    if(prevGp!=NULL){
+      for(i=0;i<par->ncell;i++)
+        coarseOfFine[i] = -1;
+      for(i=0;i<cpar.ncell;i++)
+        if(fineIndex[i]>=0) coarseOfFine[fineIndex[i]] = i;
+
+      targetIndex = malloc(sizeof(*targetIndex)*prevPar.pIntensity);
+      for(i=0;i<prevPar.pIntensity;i++)
+        targetIndex[i] = (prevFineIndex[i]>=0) ? coarseOfFine[prevFineIndex[i]] : -1;
+      _prolongPops(&cpar, md, prevGp, prevPar.pIntensity, targetIndex, cgp);
+      free(targetIndex);
+
+      freeGrid((unsigned int)prevPar.ncell, (unsigned short)prevPar.nSpecies, prevGp);
+      free(prevFineIndex);
+      cpar.init_lte = 0;
+      cpar.init_lvg = 0;
+    }
+
+    if(!silent){
+      snprintf(message, STR_LEN_0, "Multigrid level %d: solving %d grid points.", level, cpar.pIntensity);
+      printMessage(message);
+    }
+    nIters = levelPops(md, &cpar, cgp, &dummyPopsdone, lamtab, kaptab, nEntries);
+    par->nPhotonStepsCoarse += cpar.nPhotonSteps;
+    if(!silent){
+      snprintf(message, STR_LEN_0, "Multigrid level %d: %d iterations, %.3e photon steps.", level, nIters, cpar.nPhotonSteps);
+      printMessage(message);
+    }
+
+    prevPar = cpar;
+    prevGp = cgp;
+    prevFineIndex = fineIndex;
+  }
+
+  if(prevGp!=NULL){
+    _prolongPops(par, md, prevGp, prevPar.pIntensity, prevFineIndex, gp);
+    freeGrid((unsigned int)prevPar.ncell, (unsigned short)prevPar.nSpecies, prevGp);
+    free(prevFineIndex);
+    par->init_lte = 0;
+    par->init_lvg = 0;
+  }else if(!silent)
+    warning("Grid too small for multigrid initialization; none done.");
+
+  free(coarseOfFine);
+}
+
+/*....................................................................*/
+void
+reportMultigridCost(configInfo *par, const int nFineIters){
+  /*
+Compares the photon steps taken on the coarse grids with those of the full-grid solution. The cost of the coarse levels is expressed as the equivalent number of full-grid iterations, which can be set against the number of full-grid iterations the multigrid start has saved.
+  */
+  char message[STR_LEN_0];
+
+  if(nFineIters<=0 || par->nPhotonSteps<=0.0)
+return;
+
+  snprintf(message, STR_LEN_0, "Photon steps: %.3e on the coarse grids, %.3e on the full grid (%.2f full-grid iterations' worth on the coarse grids).", par->nPhotonStepsCoarse, par->nPhotonSteps, par->nPhotonStepsCoarse*nFineIters/par->nPhotonSteps);
+  printMessage(message);
+}
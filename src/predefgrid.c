@@ -16,7 +16,7 @@ predefinedGrid(configInfo *par, struct grid *gp){
   struct cell *dc=NULL; /* Not used at present. */
   unsigned long numCells,nExtraSinks;
 
-  gsl_rng *ran = gsl_rng_alloc(gsl_rng_ranlxs2);
+  gsl_rng *ran = gsl_rng_alloc(rngTypeFromPar(par->rngType));
   if(fixRandomSeeds)
     gsl_rng_set(ran,6611304);
   else
@@ -94,6 +94,8 @@ exit(1);
   par->pIntensity -= nExtraSinks;
   par->sinkPoints += nExtraSinks;
 
+  reorderGridAlongCurve(par, gp, dc, numCells);
+
   distCalc(par,gp);
 
   par->dataFlags |= (1 << DS_bit_x);
@@ -814,6 +814,54 @@ return err;
   inpar->resetRNG          = tempValue.boolValue;
   _extractScalarValue(pPars, "doSolveRTE",        parTemplates[i++].type, &tempValue);
   inpar->doSolveRTE        = tempValue.boolValue;
+  _extractScalarValue(pPars, "doNgAccel",         parTemplates[i++].type, &tempValue);
+  inpar->doNgAccel         = tempValue.boolValue;
+  _extractScalarValue(pPars, "convMedianSNR",     parTemplates[i++].type, &tempValue);
+  inpar->convMedianSNR     = tempValue.doubleValue;
+  _extractScalarValue(pPars, "convFracConverged", parTemplates[i++].type, &tempValue);
+  inpar->convFracConverged = tempValue.doubleValue;
+  _extractScalarValue(pPars, "convMaxRelChange",  parTemplates[i++].type, &tempValue);
+  inpar->convMaxRelChange  = tempValue.doubleValue;
+  _extractScalarValue(pPars, "freezeTol",         parTemplates[i++].type, &tempValue);
+  inpar->freezeTol         = tempValue.doubleValue;
+  _extractScalarValue(pPars, "freezeRefresh",     parTemplates[i++].type, &tempValue);
+  inpar->freezeRefresh     = tempValue.intValue;
+  _extractScalarValue(pPars, "pathCacheMB",       parTemplates[i++].type, &tempValue);
+  inpar->pathCacheMB       = tempValue.doubleValue;
+  _extractScalarValue(pPars, "jbarSampling",      parTemplates[i++].type, &tempValue);
+  inpar->jbarSampling      = tempValue.intValue;
+  _extractScalarValue(pPars, "nPhotMin",          parTemplates[i++].type, &tempValue);
+  inpar->nPhotMin          = tempValue.intValue;
+  _extractScalarValue(pPars, "nPhotMax",          parTemplates[i++].type, &tempValue);
+  inpar->nPhotMax          = tempValue.intValue;
+  _extractScalarValue(pPars, "lineKernel",        parTemplates[i++].type, &tempValue);
+  inpar->lineKernel        = tempValue.intValue;
+  _extractScalarValue(pPars, "statEqSolver",      parTemplates[i++].type, &tempValue);
+  inpar->statEqSolver      = tempValue.intValue;
+  _extractScalarValue(pPars, "collCacheMB",       parTemplates[i++].type, &tempValue);
+  inpar->collCacheMB       = tempValue.doubleValue;
+  _extractScalarValue(pPars, "rngType",           parTemplates[i++].type, &tempValue);
+  inpar->rngType           = tempValue.intValue;
+  _extractScalarValue(pPars, "solverSchedule",    parTemplates[i++].type, &tempValue);
+  inpar->solverSchedule    = tempValue.intValue;
+  _extractScalarValue(pPars, "gridOrdering",      parTemplates[i++].type, &tempValue);
+  inpar->gridOrdering      = tempValue.intValue;
+  _extractScalarValue(pPars, "mixedPrecision",    parTemplates[i++].type, &tempValue);
+  inpar->mixedPrecision    = tempValue.boolValue;
+  _extractScalarValue(pPars, "minPhotonExpTau",   parTemplates[i++].type, &tempValue);
+  inpar->minPhotonExpTau   = tempValue.doubleValue;
+  _extractScalarValue(pPars, "aliSchedule",       parTemplates[i++].type, &tempValue);
+  inpar->aliSchedule       = tempValue.intValue;
+  _extractScalarValue(pPars, "aliMinIters",       parTemplates[i++].type, &tempValue);
+  inpar->aliMinIters       = tempValue.intValue;
+  _extractScalarValue(pPars, "solverUpdate",      parTemplates[i++].type, &tempValue);
+  inpar->solverUpdate      = tempValue.intValue;
+  _extractScalarValue(pPars, "multigridLevels",   parTemplates[i++].type, &tempValue);
+  inpar->multigridLevels   = tempValue.intValue;
+  _extractScalarValue(pPars, "lvg_only",          parTemplates[i++].type, &tempValue);
+  inpar->lvg_only          = tempValue.boolValue;
+  _extractScalarValue(pPars, "init_lvg",          parTemplates[i++].type, &tempValue);
+  inpar->init_lvg          = tempValue.boolValue;
 
   nValues = _extractListValues(pPars, "gridOutFiles",  parTemplates[i++].type, &tempValues);
   if(nValues>0){
@@ -155,24 +155,30 @@ This function returns ds as the (always positive-valued) distance between the pr
 
 Note that this is called from within the multi-threaded block.
   */
+  const struct neighGraph *graph=gp[posn].graph;
+  const unsigned long firstLink=graph->firstLink[posn];
   double newdist, numerator, denominator ;
+  double relX[DIM];
+  float *n;
   int i;
 
+  for(i=0;i<DIM;i++)
+    relX[i] = gp[posn].x[i] - x[i];
+
   for(i=0;i<gp[posn].numNeigh;i++) {
     /* Find the shortest distance between (x,y,z) and any of the posn Voronoi faces */
-    /* ds=(p0-l0) dot n / l dot n */
+    /* ds=(p0-l0) dot n / l dot n, where the face passes through the midpoint of the link and n is the unit vector along it. */
+    n = graph->xn[firstLink+i];
 
-    numerator=((gp[posn].x[0]+gp[posn].dir[i].x[0]/2. - x[0]) * gp[posn].dir[i].x[0]+
-               (gp[posn].x[1]+gp[posn].dir[i].x[1]/2. - x[1]) * gp[posn].dir[i].x[1]+
-               (gp[posn].x[2]+gp[posn].dir[i].x[2]/2. - x[2]) * gp[posn].dir[i].x[2]);
+    numerator=relX[0]*n[0] + relX[1]*n[1] + relX[2]*n[2] + 0.5*graph->ds[firstLink+i];
 
-    denominator=(dx[0]*gp[posn].dir[i].x[0]+dx[1]*gp[posn].dir[i].x[1]+dx[2]*gp[posn].dir[i].x[2]);
+    denominator=dx[0]*n[0] + dx[1]*n[1] + dx[2]*n[2];
     
     if(fabs(denominator) > 0){
       newdist=numerator/denominator;
       if(newdist<*ds && newdist > cutoff){
         *ds=newdist;
-        *nposn=gp[posn].neigh[i]->id;
+        *nposn=(int)graph->neighI[firstLink+i];
       }
     }
   }
@@ -1368,6 +1374,8 @@ Sets elements of gp:
 
 //**** Actually we can figure out the cell geometry from the grid neighbours.
 
+    buildNeighGraph((unsigned long)par->ncell, gp, par->nThreads); /* delaunay() has replaced the .neigh arrays. */
+
     /* We need to process the list of cells a bit further - calculate their centres, and reset the id values to be the same as the index of the cell in the list. (This last because we are going to construct other lists to indicate which cells have been visited etc.)
     */
     for(dci=0;dci<numCells;dci++){
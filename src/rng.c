@@ -0,0 +1,127 @@
+/*
+ *  rng.c
+ *  This file is part of LIME, the versatile line modeling engine
+ *
+ *  See ../COPYRIGHT
+ *
+ */
+
+#include <stdint.h>
+
+#include "rng.h"
+
+/*
+A counter-based random number generator, packaged as a GSL generator type so that it can be used wherever a gsl_rng is. This is the Philox4x32-10 generator of
+
+	Salmon, J. K., Moraes, M. A., Dror, R. O. & Shaw, D. E. (2011), Proc. SC11, article 16
+
+which produces each block of four 32-bit random numbers by applying 10 rounds of a keyed bijection to a 128-bit counter. There is no state other than the key and the counter, so a generator can be moved to any point of any of 2^64 independent streams simply by setting these; see rngSetStream(). The solver uses this to give each grid vertex at each iteration its own stream, which makes the results independent of the number of threads and of the order in which the vertices are processed. The generator is also several times faster than gsl_rng_ranlxs2.
+*/
+
+#define PHILOX_M0	0xD2511F53U
+#define PHILOX_M1	0xCD9E8D57U
+#define PHILOX_W0	0x9E3779B9U
+#define PHILOX_W1	0xBB67AE85U
+#define PHILOX_ROUNDS	10
+
+typedef struct {
+  uint32_t key[2],ctr[4],out[4];
+  int nextI; /* The next unused word of out; 4 means that all have been used. */
+} philoxState;
+
+/*....................................................................*/
+void
+_philoxBlock(const uint32_t inCtr[4], const uint32_t inKey[2], uint32_t out[4]){
+  uint32_t c0=inCtr[0],c1=inCtr[1],c2=inCtr[2],c3=inCtr[3],k0=inKey[0],k1=inKey[1];
+  uint64_t p0,p1;
+  int ri;
+
+  for(ri=0;ri<PHILOX_ROUNDS;ri++){
+    p0 = (uint64_t)PHILOX_M0*c0;
+    p1 = (uint64_t)PHILOX_M1*c2;
+    c0 = (uint32_t)(p1>>32)^c1^k0;
+    c1 = (uint32_t)p1;
+    c2 = (uint32_t)(p0>>32)^c3^k1;
+    c3 = (uint32_t)p0;
+    k0 += PHILOX_W0;
+    k1 += PHILOX_W1;
+  }
+  out[0] = c0;
+  out[1] = c1;
+  out[2] = c2;
+  out[3] = c3;
+}
+
+/*....................................................................*/
+static unsigned long
+_philoxGet(void *vstate){
+  philoxState *state = vstate;
+
+  if(state->nextI>=4){
+    _philoxBlock(state->ctr, state->key, state->out);
+    /* ctr[0] and ctr[1] count blocks; ctr[2] and ctr[3] identify the stream. */
+    if(++state->ctr[0]==0) state->ctr[1]++;
+    state->nextI = 0;
+  }
+  return (unsigned long)state->out[state->nextI++];
+}
+
+/*....................................................................*/
+static double
+_philoxGetDouble(void *vstate){
+  return _philoxGet(vstate)/4294967296.0;
+}
+
+/*....................................................................*/
+static void
+_philoxSet(void *vstate, unsigned long seed){
+  philoxState *state = vstate;
+  uint64_t s = (uint64_t)seed;
+
+  state->key[0] = (uint32_t)s;
+  state->key[1] = (uint32_t)(s>>32);
+  state->ctr[0] = state->ctr[1] = state->ctr[2] = state->ctr[3] = 0;
+  state->nextI = 4;
+}
+
+static const gsl_rng_type _philoxType = {
+  "philox4x32",		/* name */
+  0xffffffffUL,		/* RAND_MAX */
+  0,			/* RAND_MIN */
+  sizeof(philoxState),
+  &_philoxSet,
+  &_philoxGet,
+  &_philoxGetDouble
+};
+
+const gsl_rng_type *rng_philox4x32 = &_philoxType;
+
+/*....................................................................*/
+const gsl_rng_type*
+rngTypeFromPar(const int rngType){
+  /* Returns the generator type selected by par->rngType. */
+  if(rngType==RNG_PHILOX)
+    return rng_philox4x32;
+  return gsl_rng_ranlxs2;
+}
+
+/*....................................................................*/
+void
+rngSetStream(gsl_rng *r, const unsigned long seed, const unsigned long stream0\
+  , const unsigned long stream1){
+  /*
+Moves r to the start of the stream identified by (seed, stream0, stream1). For generators other than rng_philox4x32, which have no notion of streams, r is simply re-seeded with a hash of the three values.
+  */
+  philoxState *state;
+
+  if(r->type!=rng_philox4x32){
+    gsl_rng_set(r, seed ^ (stream0*0x9E3779B97F4A7C15UL) ^ (stream1*0xC2B2AE3D27D4EB4FUL));
+    return;
+  }
+
+  gsl_rng_set(r, seed);
+  state = r->state;
+  state->ctr[2] = (uint32_t)stream1;
+  state->ctr[3] = (uint32_t)stream0;
+}
+
@@ -0,0 +1,25 @@
+/*
+ *  rng.h
+ *  This file is part of LIME, the versatile line modeling engine
+ *
+ *  See ../COPYRIGHT
+ *
+ */
+
+#ifndef RNG_H
+#define RNG_H
+
+#include <gsl/gsl_rng.h>
+
+/* Values of par->rngType:
+*/
+#define RNG_RANLXS2	0
+#define RNG_PHILOX	1
+
+extern const gsl_rng_type *rng_philox4x32;
+
+const gsl_rng_type*	rngTypeFromPar(const int);
+void	rngSetStream(gsl_rng*, const unsigned long, const unsigned long, const unsigned long);
+
+#endif /* RNG_H */
+
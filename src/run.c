@@ -80,6 +80,9 @@ exit(1);
     if(par->lte_only && par->nSolveIters>0)
       warning("Requesting par->nSolveIters>0 will have no effect if LTE calculation is also requested.");
 
+    else if(par->lvg_only && par->nSolveIters>0)
+      warning("Requesting par->nSolveIters>0 will have no effect if LVG calculation is also requested.");
+
     else if(par->nSolveIters<=par->nSolveItersDone && !allBitsSet(par->dataFlags, DS_mask_populations))
       warning("No supplied pops values, and par->nSolveIters <= par->nSolveItersDone.");
   }
@@ -90,7 +93,7 @@ exit(1);
     par->popsHasBeenInit = TRUE;
 
   }else{
-    if(par->nSolveIters>par->nSolveItersDone || par->lte_only) /* To save the user having to set par->doSolveRTE as well as par->nSolveIters>0 or par->lte_only. */
+    if(par->nSolveIters>par->nSolveItersDone || par->lte_only || par->lvg_only) /* To save the user having to set par->doSolveRTE as well as par->nSolveIters>0 or par->lte_only. */
       par->doSolveRTE = TRUE;
 
     par->popsHasBeenInit = FALSE;
@@ -258,6 +261,8 @@ exit(1);
     }
   }
 
+  reportPrepTimes(); /* In grid_aux.c. Also resets the timers. */
+
   if(!silent){
     if(par.nImages>0) reportOutput(img[0].filename);
     goodnight(initime);
@@ -101,10 +101,7 @@ exit(1);
 
   if(par.doMolCalcs){
     molInit(&par, md);
-    calcGridMolDoppler(&par, md, gp);
-
-    if(par.useAbun)
-      calcGridMolDensities(&par, &gp);
+    calcGridMolValues(&par, md, gp); /* Doppler widths and, if par.useAbun, molecular densities. In grid_aux.c */
   }
 
   if(par.needToInitPops)
@@ -114,8 +111,14 @@ exit(1);
     specNumDensInit(&par,md,gp);
 
   if(par.doSolveRTE){
+    if(par.multigridLevels>0 && par.needToInitPops && par.gridInFile==NULL && !par.lte_only && !par.lvg_only)
+      multigridInitPops(&par, md, gp, lamtab, kaptab, nEntries); /* In multigrid.c */
+
     nExtraSolverIters = levelPops(md, &par, gp, &dummyPopsdone, lamtab, kaptab, nEntries); /* In solver.c */
     par.nSolveItersDone += nExtraSolverIters;
+
+    if(!silent && par.multigridLevels>0)
+      reportMultigridCost(&par, nExtraSolverIters);
   }
 
   if(onlyBitsSet(par.dataFlags & DS_mask_all_but_mag, DS_mask_3))
@@ -143,6 +146,8 @@ exit(1);
     }
   }
 
+  reportPrepTimes(); /* In grid_aux.c. Also resets the timers. */
+
   if(!silent){
     if(par.nImages>0) reportOutput(img[0].filename);
     goodnight(initime);
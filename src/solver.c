@@ -9,17 +9,91 @@ TODO:
  */
 
 #include "lime.h"
+#include "sparse.h"
 #include <gsl/gsl_sort.h>
 #include <gsl/gsl_statistics.h>
 #include <gsl/gsl_vector.h>
 #include <gsl/gsl_permutation.h>
 #include <gsl/gsl_errno.h>
+#include <gsl/gsl_randist.h>
 
 /* Data concerning a single grid vertex which is passed from calculateJBar() to solveStatEq(). This data needs to be thread-safe. */
 typedef struct {
   double *jbar,*phot,*vfac,*vfac_loc;
 } gridPointData;
 
+/* Thread-private scratch space for the solver. Each thread gets one of these, which is malloc'd before the first solution iteration and reused for every grid vertex thereafter. The photon buffers are sized from the largest value of nphot, the scratch vectors from the largest nlev; the GSL objects are dimensioned per species. */
+typedef struct {
+  gridPointData *mp;
+  double *halfFirstDs,*opop,*oopop,*tempNewPop,*levScratch;
+  double *ngHist; /* Room for 3 iterates of maxNlev populations, for _ngExtrapolate() in mixed-precision mode. */
+  gsl_matrix **colli,**matrix;
+  gsl_vector **newpop,**rhVec;
+  gsl_permutation **perm;
+  int maxNphot,maxNlev,maxNline;
+  size_t numBytes;
+  double *lineScratch; /* For _lineStepSoA(). */
+  /* Photons with vfac_loc>0 gathered by _compactJBarPhotons(): */
+  double *jbVfacLoc,*jbVfac,*jbHalfDs,*jbDTau,*jbExpDTau,*jbPhot,jbVsum;
+  int jbNPhot;
+  /* Buffers in which photon paths are recorded before being copied to the path cache: */
+  double *recInidir,*recSegment,*recDsOut;
+  int *recStepStart,recStepCapacity;
+  unsigned short *recNeighI;
+  int *segmentOrder; /* Random permutation of the velocity strata for par->jbarSampling==1. */
+  /* Band matrices of the fixed and full transition rates for species which use the sparse solver (NULL for the others): */
+  double **bandColli,**bandRates,*bandScratch;
+  /* Photon counts for the present iteration, for par->minPhotonExpTau>0: */
+  long nPhotTraced,nPhotStopped,nStepsTaken,nStepsSkipped;
+  /* Number of calls to _solveStatEq() and of ALI iterations done in them in the present iteration: */
+  long nAliSolves,nAliIters;
+} solverWorkspace;
+
+/* The renumbering of the levels of one species which brings its transition rates into a band of half-width bw about the diagonal, for use with the sparse solver. This is the same at all grid points, and is shared between threads. */
+typedef struct {
+  int bw,*newIndex;
+  int *lineIdx; /* lineIdx[2*li] is the band index of the rate from the upper to the lower level of line li, lineIdx[2*li+1] that from the lower to the upper. */
+} statEqBand;
+
+/* The photon paths from a single grid vertex. Step istep, for istep=stepStart[iphot] to stepStart[iphot+1]-1, moves the photon from the present vertex to its neighbour neighI[istep], dsOut[istep] being half the edge length projected onto the photon direction. */
+typedef struct {
+  int status,nphot; /* status is 0 if the paths have not yet been recorded, 1 if they have, -1 if they did not fit in the memory budget. */
+  double *inidir,*segment,*dsOut;
+  int *stepStart;
+  unsigned short *neighI;
+} photonPaths;
+
+struct photonPathCache{
+  photonPaths *vertices;
+  size_t numBytes,maxNumBytes;
+  int numCached,numOverflow;
+};
+
+/* The fixed part of the stat. eq. matrix, as calculated by _getFixedMatrix(), of each species at each grid vertex. Only the elements listed in elemRow[ispec] and elemCol[ispec] can be non-zero; their values for vertex id are stored from values[id]+speciesOffset[ispec]. */
+struct collMatrixCache{
+  int *numElems,**elemRow,**elemCol,*speciesOffset,numValuesPerVertex;
+  double **values,*block; /* values[id]==NULL if vertex id is not cached. */
+  size_t numBytes,maxNumBytes;
+  int numCached,numOverflow;
+};
+
+/* The grid data read at each step of a photon path, stored field by field rather than point by point, so that a step touches only the few cache lines it needs instead of the whole of each struct grid and struct populations. Point id has position x[id] and so forth. The x, vel, sink and binv arrays are read-only copies. The populations, species number densities and continuum values of species ispec are moved into the slabs pops[ispec], specNumDens[ispec] and cont[ispec], which have nlev (or nline) entries per point; for the duration of the solution the .pops, .specNumDens and .cont fields of the grid points point into these. */
+struct hotGridData{
+  const struct neighGraph *graph;
+  double (*x)[DIM],(*vel)[DIM],**binv;
+  unsigned char *sink;
+  double **pops,**specNumDens;
+  struct continuumLine **cont;
+};
+
+/* The population history of a grid point, kept by levelPops() for the convergence statistics and Ng acceleration. This holds the populations of every level of species 0 (or, when levelPops() needs them, of every species, concatenated) at the last 5 iterations; with par->mixedPrecision it is stored as float in popF, otherwise as double in pop. The entries are accessed via _getHistPop() and _setHistPop(). The ave and sigma values refer to species 0 only. */
+struct statistics{
+  double *pop;
+  float *popF;
+  double *ave,*sigma,relChange;
+  _Bool frozen;
+};
+
 struct blend{
   int molJ, lineJ;
   double deltaV;
@@ -40,17 +114,30 @@ struct blendInfo{
   struct molWithBlends *mols;
 };
 
+/* The species of a vertex are solved in groups, each of which can be given to a separate task. The species with blended lines are kept together in one group; every other species is a group of its own. The species of group g are species[groupStart[g]] to species[groupStart[g+1]-1]. blendIndex[ispec] is the index in blends.mols to pass to _solveStatEq() as nextMolWithBlend for species ispec. */
+struct speciesGroups{
+  int numGroups,*groupStart,*species,*blendIndex;
+};
+
 /*....................................................................*/
 int
 _getNextEdge(double *inidir, const int startGi, const int presentGi\
-  , struct grid *gp, const gsl_rng *ran){
+  , const struct hotGridData *hot, const gsl_rng *ran){
   /*
 The idea here is to select for the next grid point, that one which lies closest (with a little randomizing jitter) to the photon track, while requiring the direction of the edge to be in the 'forward' hemisphere of the photon direction.
 
+The link data are read from the neighbour graph rather than through the .neigh and .dir fields, since this is the innermost loop of the photon propagation.
+
 Note that this is called from within the multi-threaded block.
   */
+  const struct neighGraph *graph=hot->graph;
+  const unsigned long firstLink=graph->firstLink[presentGi];
+  const float (*xn)[DIM]=(const float (*)[DIM])graph->xn + firstLink;
+  const unsigned int *neighI=graph->neighI + firstLink;
+  const int numNeigh=(int)(graph->firstLink[presentGi+1] - firstLink);
   int i,ni,niOfSmallest=-1,niOfNextSmallest=-1;
   double dirCos,distAlongTrack,dirFromStart[3],coord,distToTrackSquared,smallest=0.0,nextSmallest=0.0;
+  const double *nextX;
   const static double scatterReduction = 0.4;
   /*
 This affects the ratio of N_2/N_1, where N_2 is the number of times the edge giving the 2nd-smallest distance from the photon track is chosen and N_1 ditto the smallest. Some ratio values obtained from various values of scatterReduction:
@@ -65,15 +152,16 @@ Note that the equivalent ratio value produced by the 1.6 code was 0.91.
   */
 
   i = 0;
-  for(ni=0;ni<gp[presentGi].numNeigh;ni++){
-    dirCos = dotProduct3D(inidir, gp[presentGi].dir[ni].xn);
+  for(ni=0;ni<numNeigh;ni++){
+    dirCos = inidir[0]*xn[ni][0] + inidir[1]*xn[ni][1] + inidir[2]*xn[ni][2];
 
     if(dirCos<=0.0)
   continue; /* because the edge points in the backward direction. */
 
-    dirFromStart[0] = gp[presentGi].neigh[ni]->x[0] - gp[startGi].x[0];
-    dirFromStart[1] = gp[presentGi].neigh[ni]->x[1] - gp[startGi].x[1];
-    dirFromStart[2] = gp[presentGi].neigh[ni]->x[2] - gp[startGi].x[2];
+    nextX = hot->x[neighI[ni]];
+    dirFromStart[0] = nextX[0] - hot->x[startGi][0];
+    dirFromStart[1] = nextX[1] - hot->x[startGi][1];
+    dirFromStart[2] = nextX[2] - hot->x[startGi][2];
     distAlongTrack = dotProduct3D(inidir, dirFromStart);
 
     coord = dirFromStart[0] - distAlongTrack*inidir[0];
@@ -119,7 +207,7 @@ Note that the equivalent ratio value produced by the 1.6 code was 0.91.
 }
 
 /*....................................................................*/
-void _calcLineAmpPWLin(struct grid *g, const int id, const int k\
+void _calcLineAmpPWLin(struct grid *g, const struct hotGridData *hot, const int id, const int k\
   , const int molI, const double deltav, double *inidir, double *vfac_in, double *vfac_out){
   /*
 Note that this is called from within the multi-threaded block.
@@ -127,14 +215,15 @@ Note that this is called from within the multi-threaded block.
 
   /* convolution of a Gaussian with a box */
   double binv_this, binv_next, v[5];
+  const int next=(int)hot->graph->neighI[hot->graph->firstLink[id]+k];
 
-  binv_this=g[id].mol[molI].binv;
-  binv_next=(g[id].neigh[k])->mol[molI].binv;
-  v[0]=deltav-dotProduct3D(inidir,g[id].vel);
+  binv_this=hot->binv[molI][id];
+  binv_next=hot->binv[molI][next];
+  v[0]=deltav-dotProduct3D(inidir,hot->vel[id]);
   v[1]=deltav-dotProduct3D(inidir,&(g[id].v1[3*k]));
   v[2]=deltav-dotProduct3D(inidir,&(g[id].v2[3*k]));
   v[3]=deltav-dotProduct3D(inidir,&(g[id].v3[3*k]));
-  v[4]=deltav-dotProduct3D(inidir,g[id].neigh[k]->vel);
+  v[4]=deltav-dotProduct3D(inidir,hot->vel[next]);
 
   /* multiplying by the appropriate binv changes from velocity to doppler widths(?) */
   /* if the values were be no more than 2 erf table bins apart, we just take a single Gaussian */
@@ -160,7 +249,7 @@ Note that this is called from within the multi-threaded block.
 }
 
 /*....................................................................*/
-void _calcLineAmpLin(struct grid *g, const int id, const int k\
+void _calcLineAmpLin(const struct hotGridData *hot, const int id, const int k\
   , const int molI, const double deltav, double *inidir, double *vfac_in, double *vfac_out){
   /*
 Note that this is called from within the multi-threaded block.
@@ -168,11 +257,12 @@ Note that this is called from within the multi-threaded block.
 
   /* convolution of a Gaussian with a box */
   double binv_this, binv_next, v[3];
+  const int next=(int)hot->graph->neighI[hot->graph->firstLink[id]+k];
 
-  binv_this=g[id].mol[molI].binv;
-  binv_next=(g[id].neigh[k])->mol[molI].binv;
-  v[0]=deltav-dotProduct3D(inidir,g[id].vel);
-  v[2]=deltav-dotProduct3D(inidir,g[id].neigh[k]->vel);
+  binv_this=hot->binv[molI][id];
+  binv_next=hot->binv[molI][next];
+  v[0]=deltav-dotProduct3D(inidir,hot->vel[id]);
+  v[2]=deltav-dotProduct3D(inidir,hot->vel[next]);
   v[1]=0.5*(v[0]+v[2]);
 
   if (fabs(v[1]-v[0])*binv_this>(2.0*BIN_WIDTH)) {
@@ -186,20 +276,528 @@ Note that this is called from within the multi-threaded block.
 
 /*....................................................................*/
 void
-_calculateJBar(int id, struct grid *gp, molData *md, const gsl_rng *ran\
+_growPathRecord(solverWorkspace *ws, const int minCapacity){
+  if(minCapacity<=ws->recStepCapacity)
+return;
+
+  ws->recStepCapacity = gsl_max(2*ws->recStepCapacity, minCapacity);
+  ws->recNeighI = realloc(ws->recNeighI, sizeof(*(ws->recNeighI))*ws->recStepCapacity);
+  ws->recDsOut  = realloc(ws->recDsOut,  sizeof(*(ws->recDsOut)) *ws->recStepCapacity);
+}
+
+/*....................................................................*/
+void
+_storePhotonPaths(struct photonPathCache *cache, const int id, const int nphot\
+  , const int nSteps, solverWorkspace *ws){
+  /*
+Copies the paths just recorded in ws to the cache entry for vertex id, if there is room in the memory budget. Note that this is called from within the multi-threaded block.
+  */
+  photonPaths *path=&cache->vertices[id];
+  size_t numBytes;
+  _Bool fits;
+
+  numBytes = sizeof(double)*4*nphot + sizeof(int)*(nphot+1)\
+           + (sizeof(double) + sizeof(unsigned short))*nSteps;
+
+#pragma omp critical (pathCacheBudget)
+  {
+    fits = (cache->numBytes + numBytes <= cache->maxNumBytes);
+    if(fits){
+      cache->numBytes += numBytes;
+      cache->numCached++;
+    }else
+      cache->numOverflow++;
+  }
+
+  if(!fits){
+    path->status = -1;
+return;
+  }
+
+  path->nphot     = nphot;
+  path->inidir    = malloc(sizeof(double)*3*nphot);
+  path->segment   = malloc(sizeof(double)*nphot);
+  path->stepStart = malloc(sizeof(int)*(nphot+1));
+  path->neighI    = malloc(sizeof(unsigned short)*nSteps);
+  path->dsOut     = malloc(sizeof(double)*nSteps);
+  memcpy(path->inidir,    ws->recInidir,    sizeof(double)*3*nphot);
+  memcpy(path->segment,   ws->recSegment,   sizeof(double)*nphot);
+  memcpy(path->stepStart, ws->recStepStart, sizeof(int)*(nphot+1));
+  memcpy(path->neighI,    ws->recNeighI,    sizeof(unsigned short)*nSteps);
+  memcpy(path->dsOut,     ws->recDsOut,     sizeof(double)*nSteps);
+  path->status = 1;
+}
+
+/*....................................................................*/
+void
+_freePhotonPathCache(const int nVertices, struct photonPathCache *cache){
+  int id;
+
+  if(cache->vertices==NULL)
+return;
+
+  for(id=0;id<nVertices;id++){
+    if(cache->vertices[id].status==1){
+      free(cache->vertices[id].inidir);
+      free(cache->vertices[id].segment);
+      free(cache->vertices[id].stepStart);
+      free(cache->vertices[id].neighI);
+      free(cache->vertices[id].dsOut);
+    }
+  }
+  free(cache->vertices);
+  cache->vertices = NULL;
+}
+
+/*....................................................................*/
+void
+_invalidatePhotonPaths(struct photonPathCache *cache, const int id){
+  photonPaths *path=&cache->vertices[id];
+
+  if(path->status==1){
+    cache->numBytes -= sizeof(double)*4*path->nphot + sizeof(int)*(path->nphot+1)\
+                     + (sizeof(double) + sizeof(unsigned short))*path->stepStart[path->nphot];
+    cache->numCached--;
+    free(path->inidir);
+    free(path->segment);
+    free(path->stepStart);
+    free(path->neighI);
+    free(path->dsOut);
+  }
+  path->status = 0;
+}
+
+/*....................................................................*/
+int
+_setPhotonCounts(configInfo *par, struct grid *gp, const double *weights\
+  , struct photonPathCache *cache){
+  /*
+Shares out the fixed total of par->pIntensity*RAYS_PER_POINT photons per iteration between the grid points in proportion to weights[id], subject to each point having between par->nPhotMin and par->nPhotMax photons. The proportionality constant is found by iteratively re-scaling the share of the points which are not at either limit. Any cached photon paths for points whose number of photons changes are discarded.
+
+The return value is the new maximum number of photons per point.
+  */
+  const double budget=(double)par->pIntensity*RAYS_PER_POINT;
+  double sumW=0.0,scale,newScale,fixedTotal,freeW,nDesired;
+  int id,k,nphot,maxNphot=0;
+
+  for(id=0;id<par->pIntensity;id++)
+    sumW += weights[id];
+
+  scale = (sumW>0.0) ? budget/sumW : 0.0;
+  for(k=0;k<20 && sumW>0.0;k++){
+    fixedTotal = 0.0;
+    freeW = 0.0;
+    for(id=0;id<par->pIntensity;id++){
+      nDesired = scale*weights[id];
+      if(nDesired<=par->nPhotMin)
+        fixedTotal += par->nPhotMin;
+      else if(nDesired>=par->nPhotMax)
+        fixedTotal += par->nPhotMax;
+      else
+        freeW += weights[id];
+    }
+    if(freeW<=0.0 || fixedTotal>=budget)
+      break;
+
+    newScale = (budget - fixedTotal)/freeW;
+    if(fabs(newScale-scale)<=1.0e-6*scale)
+      break;
+    scale = newScale;
+  }
+
+  for(id=0;id<par->pIntensity;id++){
+    nphot = (int)(scale*weights[id] + 0.5);
+    if(nphot<par->nPhotMin) nphot = par->nPhotMin;
+    if(nphot>par->nPhotMax) nphot = par->nPhotMax;
+
+    if(nphot!=gp[id].nphot){
+      gp[id].nphot = nphot;
+      if(cache!=NULL)
+        _invalidatePhotonPaths(cache, id);
+    }
+    if(nphot>maxNphot) maxNphot = nphot;
+  }
+
+return maxNphot;
+}
+
+/*....................................................................*/
+void
+_randomRotationMatrix(const gsl_rng *ran, double rotMat[3][3]){
+  /*
+Generates a rotation matrix drawn uniformly from SO(3), via a uniformly-distributed unit quaternion (Shoemake 1992, Graphics Gems III, p 124).
+  */
+  double u1,u2,u3,qx,qy,qz,qw;
+
+  u1 = gsl_rng_uniform(ran);
+  u2 = gsl_rng_uniform(ran)*2.0*M_PI;
+  u3 = gsl_rng_uniform(ran)*2.0*M_PI;
+  qx = sqrt(1.0-u1)*sin(u2);
+  qy = sqrt(1.0-u1)*cos(u2);
+  qz = sqrt(u1)*sin(u3);
+  qw = sqrt(u1)*cos(u3);
+
+  rotMat[0][0] = 1.0 - 2.0*(qy*qy + qz*qz);
+  rotMat[0][1] =       2.0*(qx*qy - qz*qw);
+  rotMat[0][2] =       2.0*(qx*qz + qy*qw);
+  rotMat[1][0] =       2.0*(qx*qy + qz*qw);
+  rotMat[1][1] = 1.0 - 2.0*(qx*qx + qz*qz);
+  rotMat[1][2] =       2.0*(qy*qz - qx*qw);
+  rotMat[2][0] =       2.0*(qx*qz - qy*qw);
+  rotMat[2][1] =       2.0*(qy*qz + qx*qw);
+  rotMat[2][2] = 1.0 - 2.0*(qx*qx + qy*qy);
+}
+
+/*....................................................................*/
+void
+_fibonacciDirection(const int iphot, const int nphot, double rotMat[3][3], double *dir){
+  /*
+Returns the direction of the iphot'th of nphot points of a spherical Fibonacci lattice, rotated by rotMat. The unrotated points have equal spacing in z (so each occupies an equal area of the sphere) and are advanced in azimuth by the golden angle, which spreads them nearly uniformly.
+  */
+  const double goldenAngle = M_PI*(3.0 - sqrt(5.0));
+  double z,semiradius,phi,unrotDir[3];
+  int i;
+
+  z = 1.0 - (2.0*iphot + 1.0)/(double)nphot;
+  semiradius = sqrt(1.0 - z*z);
+  phi = goldenAngle*iphot;
+  unrotDir[0] = semiradius*cos(phi);
+  unrotDir[1] = semiradius*sin(phi);
+  unrotDir[2] = z;
+
+  for(i=0;i<3;i++)
+    dir[i] = rotMat[i][0]*unrotDir[0] + rotMat[i][1]*unrotDir[1] + rotMat[i][2]*unrotDir[2];
+}
+
+/*....................................................................*/
+void
+_lineStepScalar(configInfo *par, molData *md, struct grid *gp, const struct hotGridData *hot, const int here\
+  , const int neighI, double *inidir, const double *deltav, const double *vfac_inprev\
+  , const double *vfac_out, const double ds_in, const double ds_out, struct blendInfo blends\
+  , double **photRows, double *expTau, int *nMaserWarnings){
+  /*
+Adds to the photon intensities photRows[molI][lineI] the contributions from the two half-edges either side of grid point 'here', and updates the attenuation factors expTau, for all lines of all species, one line at a time.
+
+Note that this is called from within the multi-threaded block.
+  */
+  int iline,nextMolWithBlend,nextLineWithBlend,molI,lineI,molJ,lineJ,bi;
+  double vblend_in,vblend_out,dtau,expDTau,remnantSnu,velProj;
+
+  nextMolWithBlend = 0;
+  iline = 0;
+  for(molI=0;molI<par->nSpecies;molI++){
+    nextLineWithBlend = 0;
+    for(lineI=0;lineI<md[molI].nline;lineI++){
+      double jnu_line_in=0., jnu_line_out=0., jnu_cont=0., jnu_blend=0.;
+      double alpha_line_in=0., alpha_line_out=0., alpha_cont=0., alpha_blend=0.;
+
+      sourceFunc_line(&md[molI],vfac_inprev[molI],&(gp[here].mol[molI]),lineI,&jnu_line_in,&alpha_line_in);
+      sourceFunc_line(&md[molI],vfac_out[molI],&(gp[here].mol[molI]),lineI,&jnu_line_out,&alpha_line_out);
+      sourceFunc_cont(gp[here].mol[molI].cont[lineI],&jnu_cont,&alpha_cont);
+
+      /* cont and blend could use the same alpha and jnu counter, but maybe it's clearer this way */
+
+      /* Line blending part.
+      */
+      if(par->blend && blends.mols!=NULL && nextMolWithBlend<blends.numMolsWithBlends\
+      && molI==blends.mols[nextMolWithBlend].molI\
+      && lineI==blends.mols[nextMolWithBlend].lines[nextLineWithBlend].lineI){
+
+        for(bi=0;bi<blends.mols[nextMolWithBlend].lines[nextLineWithBlend].numBlends;bi++){
+          molJ  = blends.mols[nextMolWithBlend].lines[nextLineWithBlend].blends[bi].molJ;
+          lineJ = blends.mols[nextMolWithBlend].lines[nextLineWithBlend].blends[bi].lineJ;
+          velProj = deltav[molI] - blends.mols[nextMolWithBlend].lines[nextLineWithBlend].blends[bi].deltaV;
+          /*  */
+          if(par->edgeVelsAvailable)
+            _calcLineAmpPWLin(gp,hot,here,neighI,molJ,velProj,inidir,&vblend_in,&vblend_out);
+          else
+            _calcLineAmpLin(hot,here,neighI,molJ,velProj,inidir,&vblend_in,&vblend_out);
+
+          /* we should use also the previous vblend_in, but I don't feel like writing the necessary code now */
+          sourceFunc_line(&md[molJ],vblend_out,&(gp[here].mol[molJ]),lineJ,&jnu_blend,&alpha_blend);
+          /* note that sourceFunc* increment jnu and alpha, they don't overwrite it  */
+        }
+
+        nextLineWithBlend++;
+        if(nextLineWithBlend>=blends.mols[nextMolWithBlend].numLinesWithBlends){
+          nextLineWithBlend = 0;
+          /* The reason for doing this is as follows. Firstly, we only enter the present IF block if molI has at least 1 line which is blended with others; and further, if we have now processed all blended lines for that molecule. Thus no matter what value lineI takes for the present molecule, it won't appear as blends.mols[nextMolWithBlend].lines[i].lineI for any i. Yet we will still test blends.mols[nextMolWithBlend].lines[nextLineWithBlend], thus we want nextLineWithBlend to at least have a sensible value between 0 and blends.mols[nextMolWithBlend].numLinesWithBlends-1. We could set nextLineWithBlend to any number in this range in safety, but zero is simplest. */
+        }
+      }
+      /* End of line blending part */
+
+      /* as said above, out-in split should be done also for blended lines... */
+
+      dtau=(alpha_line_out+alpha_cont+alpha_blend)*ds_out;
+      if(dtau < -MAX_NEG_OPT_DEPTH) dtau = -MAX_NEG_OPT_DEPTH;
+      calcSourceFn(dtau, par, &remnantSnu, &expDTau);
+      remnantSnu *= (jnu_line_out+jnu_cont+jnu_blend)*ds_out;
+      photRows[molI][lineI]+=expTau[iline]*remnantSnu;
+      expTau[iline]*=expDTau;
+
+      dtau=(alpha_line_in+alpha_cont+alpha_blend)*ds_in;
+      if(dtau < -MAX_NEG_OPT_DEPTH) dtau = -MAX_NEG_OPT_DEPTH;
+      calcSourceFn(dtau, par, &remnantSnu, &expDTau);
+      remnantSnu *= (jnu_line_in+jnu_cont+jnu_blend)*ds_in;
+      photRows[molI][lineI]+=expTau[iline]*remnantSnu;
+      expTau[iline]*=expDTau;
+
+      if(expTau[iline] > exp(MAX_NEG_OPT_DEPTH)){
+        (*nMaserWarnings)++;
+        expTau[iline]=exp(MAX_NEG_OPT_DEPTH);
+      }
+
+      iline++;
+    } /* Next line this molecule. */
+
+    if(par->blend && blends.mols!=NULL && nextMolWithBlend<blends.numMolsWithBlends\
+    && molI==blends.mols[nextMolWithBlend].molI)
+      nextMolWithBlend++;
+  }
+}
+
+/*....................................................................*/
+void
+_lineStepSoA(configInfo *par, molData *md, struct grid *gp, const struct hotGridData *hot, const int here\
+  , const int neighI, double *inidir, const double *deltav, const double *vfac_inprev\
+  , const double *vfac_out, const double ds_in, const double ds_out, struct blendInfo blends\
+  , double **photRows, double *expTau, double *scratch, int *nMaserWarnings){
+  /*
+Does the same job as _lineStepScalar(), but treats the lines of each species as contiguous arrays. The blend contributions, which concern only a few lines, are first accumulated in a scalar pre-pass. The optical depths and source terms of all lines are then calculated in one vectorizable pass, the exponentials in a second (scalar) pass, and the intensity and attenuation updates, with branch-free selection of the Taylor approximation and a masked maser clamp, in a third vectorizable pass.
+
+The arithmetic done for each line is the same, and in the same order, as in _lineStepScalar() and calcSourceFn(), so the two give bitwise identical results, provided the compiler does not contract multiplies and adds into fused multiply-adds differently in the two (which can happen if FMA instructions are enabled, e.g. via -march=native). This is checked in TEST builds. The scratch vector must have room for 8*nline doubles for the species with the most lines.
+
+Note that this is called from within the multi-threaded block.
+  */
+  int iline=0,nextMolWithBlend=0,molI,lineI,k,bi,molJ,lineJ,nline,nMasers=0;
+  double vblend_in,vblend_out,velProj,vfacIn,vfacOut;
+  double *jBlend,*aBlend,*dTauOut,*dTauIn,*expOut,*expIn,*jSumOut,*jSumIn,*phot,*eTau;
+  const double maxExpTau=exp(MAX_NEG_OPT_DEPTH),taylorCutoff=par->taylorCutoff;
+  const double *specNumDens;
+  const struct continuumLine *cont;
+  const molData *m;
+  struct lineWithBlends *lineB;
+
+  for(molI=0;molI<par->nSpecies;molI++){
+    m = &md[molI];
+    nline = m->nline;
+    specNumDens = hot->specNumDens[molI] + (size_t)here*m->nlev;
+    cont = hot->cont[molI] + (size_t)here*nline;
+    vfacIn  = vfac_inprev[molI];
+    vfacOut = vfac_out[molI];
+    phot = photRows[molI];
+    eTau = expTau + iline;
+
+    jBlend  = scratch;
+    aBlend  = scratch + nline;
+    dTauOut = scratch + 2*nline;
+    dTauIn  = scratch + 3*nline;
+    expOut  = scratch + 4*nline;
+    expIn   = scratch + 5*nline;
+    jSumOut = scratch + 6*nline;
+    jSumIn  = scratch + 7*nline;
+
+    /* Pre-pass: blended-line contributions.
+    */
+    for(lineI=0;lineI<nline;lineI++){
+      jBlend[lineI] = 0.0;
+      aBlend[lineI] = 0.0;
+    }
+    if(par->blend && blends.mols!=NULL && nextMolWithBlend<blends.numMolsWithBlends\
+    && molI==blends.mols[nextMolWithBlend].molI){
+      for(k=0;k<blends.mols[nextMolWithBlend].numLinesWithBlends;k++){
+        lineB = &blends.mols[nextMolWithBlend].lines[k];
+        for(bi=0;bi<lineB->numBlends;bi++){
+          molJ  = lineB->blends[bi].molJ;
+          lineJ = lineB->blends[bi].lineJ;
+          velProj = deltav[molI] - lineB->blends[bi].deltaV;
+          if(par->edgeVelsAvailable)
+            _calcLineAmpPWLin(gp,hot,here,neighI,molJ,velProj,inidir,&vblend_in,&vblend_out);
+          else
+            _calcLineAmpLin(hot,here,neighI,molJ,velProj,inidir,&vblend_in,&vblend_out);
+
+          sourceFunc_line(&md[molJ],vblend_out,&(gp[here].mol[molJ]),lineJ,&jBlend[lineB->lineI],&aBlend[lineB->lineI]);
+        }
+      }
+      nextMolWithBlend++;
+    }
+
+    /* Pass 1: optical depths and emission of the two half-edges.
+    */
+#pragma omp simd
+    for(lineI=0;lineI<nline;lineI++){
+      double nU,nL,jCont,aCont,jLineIn,jLineOut,aLineIn,aLineOut,dTau;
+
+      nU = specNumDens[m->lau[lineI]];
+      nL = specNumDens[m->lal[lineI]];
+      jLineIn  = vfacIn *HPIP*nU*m->aeinst[lineI];
+      jLineOut = vfacOut*HPIP*nU*m->aeinst[lineI];
+      aLineIn  = vfacIn *HPIP*(nL*m->beinstl[lineI] - nU*m->beinstu[lineI]);
+      aLineOut = vfacOut*HPIP*(nL*m->beinstl[lineI] - nU*m->beinstu[lineI]);
+      jCont = cont[lineI].dust*cont[lineI].knu;
+      aCont = cont[lineI].knu;
+
+      dTau = (aLineOut + aCont + aBlend[lineI])*ds_out;
+      dTauOut[lineI] = (dTau < -MAX_NEG_OPT_DEPTH) ? -MAX_NEG_OPT_DEPTH : dTau;
+      dTau = (aLineIn  + aCont + aBlend[lineI])*ds_in;
+      dTauIn[lineI]  = (dTau < -MAX_NEG_OPT_DEPTH) ? -MAX_NEG_OPT_DEPTH : dTau;
+      jSumOut[lineI] = (jLineOut + jCont + jBlend[lineI])*ds_out;
+      jSumIn[lineI]  = (jLineIn  + jCont + jBlend[lineI])*ds_in;
+    }
+
+    /* Pass 2: the exponentials.
+    */
+    for(lineI=0;lineI<nline;lineI++){
+#ifdef FASTEXP
+      expOut[lineI] = FastExp(dTauOut[lineI]);
+      expIn[lineI]  = FastExp(dTauIn[lineI]);
+#else
+      expOut[lineI] = (fabs(dTauOut[lineI])<taylorCutoff) ? 0.0 : exp(-dTauOut[lineI]);
+      expIn[lineI]  = (fabs(dTauIn[lineI]) <taylorCutoff) ? 0.0 : exp(-dTauIn[lineI]);
+#endif
+    }
+
+    /* Pass 3: accumulate the intensity and the attenuation.
+    */
+#pragma omp simd reduction(+:nMasers)
+    for(lineI=0;lineI<nline;lineI++){
+      double dTau,remnantSnu,expDTau,taylorSnu;
+      int isTaylor,isMaser;
+
+      dTau = dTauOut[lineI];
+      isTaylor = (fabs(dTau)<taylorCutoff);
+      taylorSnu = 1. - dTau*(1. - dTau*(1./3.))*(1./2.);
+#ifdef FASTEXP
+      expDTau = expOut[lineI];
+#else
+      expDTau = isTaylor ? 1. - dTau*taylorSnu : expOut[lineI];
+#endif
+      remnantSnu = isTaylor ? taylorSnu : (1.-expDTau)/dTau;
+      remnantSnu *= jSumOut[lineI];
+      phot[lineI] += eTau[lineI]*remnantSnu;
+      eTau[lineI] *= expDTau;
+
+      dTau = dTauIn[lineI];
+      isTaylor = (fabs(dTau)<taylorCutoff);
+      taylorSnu = 1. - dTau*(1. - dTau*(1./3.))*(1./2.);
+#ifdef FASTEXP
+      expDTau = expIn[lineI];
+#else
+      expDTau = isTaylor ? 1. - dTau*taylorSnu : expIn[lineI];
+#endif
+      remnantSnu = isTaylor ? taylorSnu : (1.-expDTau)/dTau;
+      remnantSnu *= jSumIn[lineI];
+      phot[lineI] += eTau[lineI]*remnantSnu;
+      eTau[lineI] *= expDTau;
+
+      isMaser = (eTau[lineI] > maxExpTau);
+      nMasers += isMaser;
+      eTau[lineI] = isMaser ? maxExpTau : eTau[lineI];
+    }
+
+    iline += nline;
+  }
+
+  *nMaserWarnings += nMasers;
+}
+
+#ifdef TEST
+/*....................................................................*/
+void
+_checkLineKernels(configInfo *par, molData *md, struct grid *gp, const struct hotGridData *hot, const int here\
+  , const int neighI, double *inidir, const double *deltav, const double *vfac_inprev\
+  , const double *vfac_out, const double ds_in, const double ds_out, struct blendInfo blends\
+  , double **photRows, double *expTau, double *scratch){
+  /*
+Runs _lineStepScalar() and _lineStepSoA() on copies of the present photon data and bails out if the results are not identical to the last bit. If the compiler may use fused multiply-adds, a relative difference of a few units of round-off is allowed instead.
+  */
+  int molI,lineI,iline,nlinetot=0,dummyMasers=0;
+  _Bool differ=0;
+  char message[STR_LEN_0];
+
+  for(molI=0;molI<par->nSpecies;molI++)
+    nlinetot += md[molI].nline;
+
+  double scalarPhot[nlinetot],soaPhot[nlinetot],scalarExpTau[nlinetot],soaExpTau[nlinetot];
+  double *scalarRows[par->nSpecies],*soaRows[par->nSpecies];
+
+  iline = 0;
+  for(molI=0;molI<par->nSpecies;molI++){
+    scalarRows[molI] = scalarPhot + iline;
+    soaRows[molI]    = soaPhot    + iline;
+    for(lineI=0;lineI<md[molI].nline;lineI++){
+      scalarPhot[iline] = photRows[molI][lineI];
+      soaPhot[iline]    = photRows[molI][lineI];
+      iline++;
+    }
+  }
+  memcpy(scalarExpTau, expTau, sizeof(double)*nlinetot);
+  memcpy(soaExpTau,    expTau, sizeof(double)*nlinetot);
+
+  _lineStepScalar(par,md,gp,hot,here,neighI,inidir,deltav,vfac_inprev,vfac_out,ds_in,ds_out,blends,scalarRows,scalarExpTau,&dummyMasers);
+  _lineStepSoA(par,md,gp,hot,here,neighI,inidir,deltav,vfac_inprev,vfac_out,ds_in,ds_out,blends,soaRows,soaExpTau,scratch,&dummyMasers);
+
+#ifdef __FP_FAST_FMA
+  for(iline=0;iline<nlinetot;iline++){
+    if(fabs(scalarPhot[iline]-soaPhot[iline])>1.0e-13*fabs(scalarPhot[iline])\
+    || fabs(scalarExpTau[iline]-soaExpTau[iline])>1.0e-13*fabs(scalarExpTau[iline]))
+      differ = 1;
+  }
+#else
+  differ = (memcmp(scalarPhot, soaPhot, sizeof(double)*nlinetot)!=0\
+         || memcmp(scalarExpTau, soaExpTau, sizeof(double)*nlinetot)!=0);
+#endif
+
+  if(differ){
+    if(!silent){
+      snprintf(message, STR_LEN_0, "SoA line kernel differs from scalar at point %d.", here);
+      bail_out(message);
+    }
+exit(1);
+  }
+}
+#endif
+
+/*....................................................................*/
+void
+_calculateJBar(int id, struct grid *gp, const struct hotGridData *hot, molData *md, const gsl_rng *ran\
   , configInfo *par, const int nlinetot, struct blendInfo blends\
-  , gridPointData *mp, double *halfFirstDs, int *nMaserWarnings){
+  , solverWorkspace *ws, struct photonPathCache *cache, int *nMaserWarnings){
   /*
 Note that this is called from within the multi-threaded block.
+
+If cache is not NULL, the photon directions, velocity offsets and paths through the grid are taken from the cache entry for vertex id if these have been recorded; otherwise they are generated and, if there is room, recorded there for use in subsequent iterations.
+
+If par->minPhotonExpTau>0, a photon is stopped as soon as expTau for every line has fallen below this value, since nothing further along its path can then make a significant difference to its intensity. The CMB term, which would be attenuated by the same factor, is then omitted. Paths which are being recorded for the cache are always followed to the sink, so that they can be replayed in later iterations, in which the optical depths may be smaller.
   */
 
-  int iphot,iline,here,there,firststep,neighI,numLinks=0;
-  int nextMolWithBlend, nextLineWithBlend, molI, lineI, molJ, lineJ, bi;
-  double segment,vblend_in,vblend_out,dtau,expDTau,ds_in=0.0,ds_out=0.0,pt_theta,pt_z,semiradius;
+  int iphot,iline,here,there,firststep,neighI,numLinks=0,istep=0;
+  int molI, lineI;
+  double segment,ds_in=0.0,ds_out=0.0,dsProj,pt_theta,pt_z,semiradius,maxExpTau;
+  _Bool stopped;
   double deltav[par->nSpecies],vfac_in[par->nSpecies],vfac_out[par->nSpecies],vfac_inprev[par->nSpecies];
-  double expTau[nlinetot],inidir[3];
-  double remnantSnu,velProj;
+  double expTau[nlinetot],inidir[3],*photRows[par->nSpecies];
+  gridPointData *mp=ws->mp;
+  double *halfFirstDs=ws->halfFirstDs;
+  photonPaths *path=NULL;
+  _Bool replay=0,record=0;
+  double rotMat[3][3];
   char message[STR_LEN_0];
+  const struct neighGraph *graph=hot->graph;
+  unsigned long li;
+
+  if(cache!=NULL){
+    path = &cache->vertices[id];
+    replay = (path->status==1);
+    record = (path->status==0);
+  }
+
+  if(par->jbarSampling==1 && !replay){
+    _randomRotationMatrix(ran, rotMat);
+    for(iphot=0;iphot<gp[id].nphot;iphot++)
+      ws->segmentOrder[iphot] = iphot;
+    gsl_ran_shuffle(ran, ws->segmentOrder, (size_t)gp[id].nphot, sizeof(int));
+  }
 
   for(iphot=0;iphot<gp[id].nphot;iphot++){
     firststep=1;
@@ -212,22 +810,45 @@ Note that this is called from within the multi-threaded block.
       }
     }
 
-    /* Choose random initial photon direction (the distribution used here is even over the surface of a sphere of radius 1).
-    */
-    pt_theta=gsl_rng_uniform(ran)*2*M_PI;
-    pt_z=2*gsl_rng_uniform(ran)-1;
-    semiradius = sqrt(1.-pt_z*pt_z);
-    inidir[0]=semiradius*cos(pt_theta);
-    inidir[1]=semiradius*sin(pt_theta);
-    inidir[2]=pt_z;
-
-    /* Choose the photon frequency/velocity offset.
-    */
-    segment=gsl_rng_uniform(ran)-0.5;
-    /*
-    Values of segment should be evenly distributed (considering the
-    entire ensemble of photons) between -0.5 and +0.5.
-    */
+    if(replay){
+      inidir[0] = path->inidir[3*iphot];
+      inidir[1] = path->inidir[3*iphot+1];
+      inidir[2] = path->inidir[3*iphot+2];
+      segment = path->segment[iphot];
+      istep = path->stepStart[iphot];
+
+    }else if(par->jbarSampling==1){
+      /* Quasi-random direction, and a velocity offset drawn from a randomly-assigned one of nphot equal strata of [-0.5,0.5).
+      */
+      _fibonacciDirection(iphot, gp[id].nphot, rotMat, inidir);
+      segment=(ws->segmentOrder[iphot] + gsl_rng_uniform(ran))/(double)gp[id].nphot - 0.5;
+
+    }else{
+      /* Choose random initial photon direction (the distribution used here is even over the surface of a sphere of radius 1).
+      */
+      pt_theta=gsl_rng_uniform(ran)*2*M_PI;
+      pt_z=2*gsl_rng_uniform(ran)-1;
+      semiradius = sqrt(1.-pt_z*pt_z);
+      inidir[0]=semiradius*cos(pt_theta);
+      inidir[1]=semiradius*sin(pt_theta);
+      inidir[2]=pt_z;
+
+      /* Choose the photon frequency/velocity offset.
+      */
+      segment=gsl_rng_uniform(ran)-0.5;
+      /*
+      Values of segment should be evenly distributed (considering the
+      entire ensemble of photons) between -0.5 and +0.5.
+      */
+    }
+
+    if(record){
+      ws->recInidir[3*iphot]   = inidir[0];
+      ws->recInidir[3*iphot+1] = inidir[1];
+      ws->recInidir[3*iphot+2] = inidir[2];
+      ws->recSegment[iphot] = segment;
+      ws->recStepStart[iphot] = istep;
+    }
 
     for (molI=0;molI<par->nSpecies;molI++){
       /* Is factor 4.3=[-2.15,2.15] enough?? */
@@ -243,7 +864,8 @@ Note that this is called from within the multi-threaded block.
 
     /* Photon propagation loop */
     numLinks=0;
-    while(!gp[here].sink){ /* Testing for sink at loop start is redundant for the first step, since we only start photons from non-sink points, but it makes for simpler code. */
+    stopped=0;
+    while(!hot->sink[here]){ /* Testing for sink at loop start is redundant for the first step, since we only start photons from non-sink points, but it makes for simpler code. */
       numLinks++;
       if(numLinks>par->ncell){
         if(!silent){
@@ -253,20 +875,33 @@ Note that this is called from within the multi-threaded block.
 exit(1);
       }
 
-      neighI = _getNextEdge(inidir,id,here,gp,ran);
+      if(replay){
+        neighI = (int)path->neighI[istep];
+        dsProj = path->dsOut[istep];
+      }else{
+        neighI = _getNextEdge(inidir,id,here,hot,ran);
+        li = graph->firstLink[here] + neighI;
+        dsProj = 0.5*graph->ds[li]*(inidir[0]*graph->xn[li][0] + inidir[1]*graph->xn[li][1] + inidir[2]*graph->xn[li][2]);
+        if(record){
+          _growPathRecord(ws, istep+1);
+          ws->recNeighI[istep] = (unsigned short)neighI;
+          ws->recDsOut[istep] = dsProj;
+        }
+      }
+      istep++;
 
-      there=gp[here].neigh[neighI]->id;
+      there=(int)graph->neighI[graph->firstLink[here] + neighI];
 
       if(firststep){
         firststep=0;
-        ds_out=0.5*gp[here].ds[neighI]*dotProduct3D(inidir,gp[here].dir[neighI].xn);
+        ds_out=dsProj;
         halfFirstDs[iphot]=ds_out;
 
         for(molI=0;molI<par->nSpecies;molI++){
           if(par->edgeVelsAvailable) {
-            _calcLineAmpPWLin(gp,here,neighI,molI,deltav[molI],inidir,&vfac_in[molI],&vfac_out[molI]);
+            _calcLineAmpPWLin(gp,hot,here,neighI,molI,deltav[molI],inidir,&vfac_in[molI],&vfac_out[molI]);
          } else
-            _calcLineAmpLin(gp,here,neighI,molI,deltav[molI],inidir,&vfac_in[molI],&vfac_out[molI]);
+            _calcLineAmpLin(hot,here,neighI,molI,deltav[molI],inidir,&vfac_in[molI],&vfac_out[molI]);
 
           mp[molI].vfac[iphot]=vfac_out[molI];
         }
@@ -281,99 +916,64 @@ exit(1);
       /* If we've got to here, we have progressed beyond the first edge. Length of the new "in" edge is the length of the previous "out".
       */
       ds_in=ds_out;
-      ds_out=0.5*gp[here].ds[neighI]*dotProduct3D(inidir,gp[here].dir[neighI].xn);
+      ds_out=dsProj;
 
       for(molI=0;molI<par->nSpecies;molI++){
         vfac_inprev[molI]=vfac_in[molI];
         if(par->edgeVelsAvailable)
-          _calcLineAmpPWLin(gp,here,neighI,molI,deltav[molI],inidir,&vfac_in[molI],&vfac_out[molI]);
+          _calcLineAmpPWLin(gp,hot,here,neighI,molI,deltav[molI],inidir,&vfac_in[molI],&vfac_out[molI]);
         else
-          _calcLineAmpLin(gp,here,neighI,molI,deltav[molI],inidir,&vfac_in[molI],&vfac_out[molI]);
+          _calcLineAmpLin(hot,here,neighI,molI,deltav[molI],inidir,&vfac_in[molI],&vfac_out[molI]);
       }
 
-      nextMolWithBlend = 0;
-      iline = 0;
-      for(molI=0;molI<par->nSpecies;molI++){
-        nextLineWithBlend = 0;
-        for(lineI=0;lineI<md[molI].nline;lineI++){
-          double jnu_line_in=0., jnu_line_out=0., jnu_cont=0., jnu_blend=0.;
-          double alpha_line_in=0., alpha_line_out=0., alpha_cont=0., alpha_blend=0.;
-
-          sourceFunc_line(&md[molI],vfac_inprev[molI],&(gp[here].mol[molI]),lineI,&jnu_line_in,&alpha_line_in);
-          sourceFunc_line(&md[molI],vfac_out[molI],&(gp[here].mol[molI]),lineI,&jnu_line_out,&alpha_line_out);
-          sourceFunc_cont(gp[here].mol[molI].cont[lineI],&jnu_cont,&alpha_cont);
-
-          /* cont and blend could use the same alpha and jnu counter, but maybe it's clearer this way */
-
-          /* Line blending part.
-          */
-          if(par->blend && blends.mols!=NULL && molI==blends.mols[nextMolWithBlend].molI\
-          && lineI==blends.mols[nextMolWithBlend].lines[nextLineWithBlend].lineI){
-
-            for(bi=0;bi<blends.mols[nextMolWithBlend].lines[nextLineWithBlend].numBlends;bi++){
-              molJ  = blends.mols[nextMolWithBlend].lines[nextLineWithBlend].blends[bi].molJ;
-              lineJ = blends.mols[nextMolWithBlend].lines[nextLineWithBlend].blends[bi].lineJ;
-              velProj = deltav[molI] - blends.mols[nextMolWithBlend].lines[nextLineWithBlend].blends[bi].deltaV;
-	      /*  */
-              if(par->edgeVelsAvailable)
-                _calcLineAmpPWLin(gp,here,neighI,molJ,velProj,inidir,&vblend_in,&vblend_out);
-              else
-                _calcLineAmpLin(gp,here,neighI,molJ,velProj,inidir,&vblend_in,&vblend_out);
-
-	      /* we should use also the previous vblend_in, but I don't feel like writing the necessary code now */
-              sourceFunc_line(&md[molJ],vblend_out,&(gp[here].mol[molJ]),lineJ,&jnu_blend,&alpha_blend);
-              /* note that sourceFunc* increment jnu and alpha, they don't overwrite it  */
-            }
-
-            nextLineWithBlend++;
-            if(nextLineWithBlend>=blends.mols[nextMolWithBlend].numLinesWithBlends){
-              nextLineWithBlend = 0;
-              /* The reason for doing this is as follows. Firstly, we only enter the present IF block if molI has at least 1 line which is blended with others; and further, if we have now processed all blended lines for that molecule. Thus no matter what value lineI takes for the present molecule, it won't appear as blends.mols[nextMolWithBlend].lines[i].lineI for any i. Yet we will still test blends.mols[nextMolWithBlend].lines[nextLineWithBlend], thus we want nextLineWithBlend to at least have a sensible value between 0 and blends.mols[nextMolWithBlend].numLinesWithBlends-1. We could set nextLineWithBlend to any number in this range in safety, but zero is simplest. */
-            }
-          }
-          /* End of line blending part */
-
-	  /* as said above, out-in split should be done also for blended lines... */
-
-	  dtau=(alpha_line_out+alpha_cont+alpha_blend)*ds_out;
-          if(dtau < -MAX_NEG_OPT_DEPTH) dtau = -MAX_NEG_OPT_DEPTH;
-          calcSourceFn(dtau, par, &remnantSnu, &expDTau);
-          remnantSnu *= (jnu_line_out+jnu_cont+jnu_blend)*ds_out;
-          mp[molI].phot[lineI+iphot*md[molI].nline]+=expTau[iline]*remnantSnu;
-	  expTau[iline]*=expDTau;
-
-	  dtau=(alpha_line_in+alpha_cont+alpha_blend)*ds_in;
-          if(dtau < -MAX_NEG_OPT_DEPTH) dtau = -MAX_NEG_OPT_DEPTH;
-          calcSourceFn(dtau, par, &remnantSnu, &expDTau);
-          remnantSnu *= (jnu_line_in+jnu_cont+jnu_blend)*ds_in;
-          mp[molI].phot[lineI+iphot*md[molI].nline]+=expTau[iline]*remnantSnu;
-	  expTau[iline]*=expDTau;
-
-          if(expTau[iline] > exp(MAX_NEG_OPT_DEPTH)){
-            (*nMaserWarnings)++;
-            expTau[iline]=exp(MAX_NEG_OPT_DEPTH);
-          }
-
-          iline++;
-        } /* Next line this molecule. */
+      for(molI=0;molI<par->nSpecies;molI++)
+        photRows[molI] = &mp[molI].phot[iphot*md[molI].nline];
 
-        if(par->blend && blends.mols!=NULL && molI==blends.mols[nextMolWithBlend].molI)
-          nextMolWithBlend++;
+      if(par->lineKernel==1){
+#ifdef TEST
+        _checkLineKernels(par,md,gp,hot,here,neighI,inidir,deltav,vfac_inprev,vfac_out,ds_in,ds_out,blends,photRows,expTau,ws->lineScratch);
+#endif
+        _lineStepSoA(par,md,gp,hot,here,neighI,inidir,deltav,vfac_inprev,vfac_out,ds_in,ds_out,blends,photRows,expTau,ws->lineScratch,nMaserWarnings);
+      }else
+        _lineStepScalar(par,md,gp,hot,here,neighI,inidir,deltav,vfac_inprev,vfac_out,ds_in,ds_out,blends,photRows,expTau,nMaserWarnings);
+
+      if(par->minPhotonExpTau>0.0 && !record){
+        maxExpTau = 0.0;
+        for(iline=0;iline<nlinetot;iline++)
+          if(expTau[iline]>maxExpTau) maxExpTau = expTau[iline];
+        if(maxExpTau<par->minPhotonExpTau){
+          stopped = 1;
+    break;
+        }
       }
 
       here=there;
     };
 
-    /* Add cmb contribution.
-    */
-    iline = 0;
-    for(molI=0;molI<par->nSpecies;molI++){
-      for(lineI=0;lineI<md[molI].nline;lineI++){
-        mp[molI].phot[lineI+iphot*md[molI].nline]+=expTau[iline]*md[molI].cmb[lineI];
-        iline++;
+    ws->nPhotTraced++;
+    ws->nStepsTaken += numLinks;
+    if(stopped){
+      ws->nPhotStopped++;
+      if(replay)
+        ws->nStepsSkipped += path->stepStart[iphot+1] - istep;
+
+    }else{
+      /* Add cmb contribution.
+      */
+      iline = 0;
+      for(molI=0;molI<par->nSpecies;molI++){
+        for(lineI=0;lineI<md[molI].nline;lineI++){
+          mp[molI].phot[lineI+iphot*md[molI].nline]+=expTau[iline]*md[molI].cmb[lineI];
+          iline++;
+        }
       }
     }
   }
+
+  if(record){
+    ws->recStepStart[gp[id].nphot] = istep;
+    _storePhotonPaths(cache, id, gp[id].nphot, istep, ws);
+  }
 }
 /*....................................................................*/
 void
@@ -394,19 +994,201 @@ _freeMolsWithBlends(struct molWithBlends *mols, const int numMolsWithBlends){
 
 /*....................................................................*/
 void
-_freeGridPointData(const int nSpecies, gridPointData *mol){
+_groupSpecies(configInfo *par, struct blendInfo blends, struct speciesGroups *groups){
   /*
-Note that this is called from within the multi-threaded block.
+Sets up the groups of species described at the definition of struct speciesGroups. For a species with blends, blendIndex is the position of its entry in blends.mols; for the others, which have no entry there, it is 0, which keeps the index valid.
   */
-  int i;
-  if(mol!= NULL){
-    for(i=0;i<nSpecies;i++){
-      free(mol[i].jbar);
-      free(mol[i].phot);
-      free(mol[i].vfac);
-      free(mol[i].vfac_loc);
+  int ispec,k,nextMolWithBlend,numBlended;
+  _Bool *isBlended;
+
+  groups->groupStart = malloc(sizeof(*(groups->groupStart))*(par->nSpecies+1));
+  groups->species    = malloc(sizeof(*(groups->species))   *par->nSpecies);
+  groups->blendIndex = malloc(sizeof(*(groups->blendIndex))*par->nSpecies);
+  isBlended = calloc(par->nSpecies, sizeof(*isBlended));
+
+  nextMolWithBlend = 0;
+  for(ispec=0;ispec<par->nSpecies;ispec++){
+    groups->blendIndex[ispec] = 0;
+    if(par->blend && blends.mols!=NULL && nextMolWithBlend<blends.numMolsWithBlends\
+    && ispec==blends.mols[nextMolWithBlend].molI){
+      isBlended[ispec] = 1;
+      groups->blendIndex[ispec] = nextMolWithBlend++;
+    }
+  }
+
+  groups->numGroups = 0;
+  k = 0;
+  numBlended = 0;
+  for(ispec=0;ispec<par->nSpecies;ispec++){
+    if(isBlended[ispec]){
+      if(numBlended==0) groups->groupStart[groups->numGroups++] = k;
+      groups->species[k++] = ispec;
+      numBlended++;
+    }
+  }
+  for(ispec=0;ispec<par->nSpecies;ispec++){
+    if(!isBlended[ispec]){
+      groups->groupStart[groups->numGroups++] = k;
+      groups->species[k++] = ispec;
+    }
+  }
+  groups->groupStart[groups->numGroups] = k;
+
+  free(isBlended);
+}
+
+/*....................................................................*/
+void
+_freeSpeciesGroups(struct speciesGroups *groups){
+  free(groups->groupStart);
+  free(groups->species);
+  free(groups->blendIndex);
+}
+
+/*....................................................................*/
+void
+_mallocSolverWorkspace(configInfo *par, molData *md, const int maxNphot\
+  , statEqBand **statEqBands, solverWorkspace *ws){
+  /*
+Allocates all the per-vertex working storage needed by _calculateJBar() and _solveStatEq(), and records the total number of bytes taken.
+  */
+  int ispec,nlev,nBand;
+  size_t nBytes=0;
+
+  ws->maxNphot = maxNphot;
+  ws->maxNlev = 0;
+  ws->maxNline = 0;
+  for(ispec=0;ispec<par->nSpecies;ispec++){
+    if(md[ispec].nlev >ws->maxNlev)  ws->maxNlev  = md[ispec].nlev;
+    if(md[ispec].nline>ws->maxNline) ws->maxNline = md[ispec].nline;
+  }
+
+  ws->mp = malloc(sizeof(*(ws->mp))*par->nSpecies);
+  nBytes += sizeof(*(ws->mp))*par->nSpecies;
+  for(ispec=0;ispec<par->nSpecies;ispec++){
+    ws->mp[ispec].jbar     = malloc(sizeof(double)*md[ispec].nline);
+    ws->mp[ispec].phot     = malloc(sizeof(double)*md[ispec].nline*maxNphot);
+    ws->mp[ispec].vfac     = malloc(sizeof(double)*                maxNphot);
+    ws->mp[ispec].vfac_loc = malloc(sizeof(double)*                maxNphot);
+    nBytes += sizeof(double)*(md[ispec].nline*(1+maxNphot) + 2*maxNphot);
+  }
+  ws->halfFirstDs = malloc(sizeof(*(ws->halfFirstDs))*maxNphot);
+  nBytes += sizeof(*(ws->halfFirstDs))*maxNphot;
+
+  ws->opop       = malloc(sizeof(*(ws->opop))      *ws->maxNlev);
+  ws->oopop      = malloc(sizeof(*(ws->oopop))     *ws->maxNlev);
+  ws->tempNewPop = malloc(sizeof(*(ws->tempNewPop))*ws->maxNlev);
+  ws->levScratch = malloc(sizeof(*(ws->levScratch))*ws->maxNlev);
+  ws->ngHist     = malloc(sizeof(*(ws->ngHist))    *ws->maxNlev*3);
+  nBytes += 7*sizeof(double)*ws->maxNlev;
+
+  ws->recInidir    = malloc(sizeof(*(ws->recInidir))   *3*maxNphot);
+  ws->recSegment   = malloc(sizeof(*(ws->recSegment))  *maxNphot);
+  ws->recStepStart = malloc(sizeof(*(ws->recStepStart))*(maxNphot+1));
+  nBytes += 4*sizeof(double)*maxNphot + sizeof(int)*(maxNphot+1);
+  ws->recStepCapacity = 0; /* The step buffers are grown as needed by _growPathRecord(). */
+  ws->recNeighI = NULL;
+  ws->recDsOut  = NULL;
+
+  ws->segmentOrder = malloc(sizeof(*(ws->segmentOrder))*maxNphot);
+  nBytes += sizeof(int)*maxNphot;
+
+  ws->lineScratch = malloc(sizeof(*(ws->lineScratch))*8*ws->maxNline);
+  nBytes += sizeof(double)*8*ws->maxNline;
+
+  ws->jbVfacLoc = malloc(sizeof(*(ws->jbVfacLoc))*maxNphot);
+  ws->jbVfac    = malloc(sizeof(*(ws->jbVfac))   *maxNphot);
+  ws->jbHalfDs  = malloc(sizeof(*(ws->jbHalfDs)) *maxNphot);
+  ws->jbDTau    = malloc(sizeof(*(ws->jbDTau))   *maxNphot);
+  ws->jbExpDTau = malloc(sizeof(*(ws->jbExpDTau))*maxNphot);
+  ws->jbPhot    = malloc(sizeof(*(ws->jbPhot))   *maxNphot*ws->maxNline);
+  nBytes += sizeof(double)*maxNphot*(5 + ws->maxNline);
+
+  ws->colli  = malloc(sizeof(*(ws->colli)) *par->nSpecies);
+  ws->matrix = malloc(sizeof(*(ws->matrix))*par->nSpecies);
+  ws->newpop = malloc(sizeof(*(ws->newpop))*par->nSpecies);
+  ws->rhVec  = malloc(sizeof(*(ws->rhVec)) *par->nSpecies);
+  ws->perm   = malloc(sizeof(*(ws->perm))  *par->nSpecies);
+  for(ispec=0;ispec<par->nSpecies;ispec++){
+    nlev = md[ispec].nlev;
+    ws->colli[ispec]  = gsl_matrix_alloc(nlev, nlev);
+    ws->matrix[ispec] = gsl_matrix_alloc(nlev, nlev);
+    ws->newpop[ispec] = gsl_vector_alloc(nlev);
+    ws->rhVec[ispec]  = gsl_vector_alloc(nlev);
+    ws->perm[ispec]   = gsl_permutation_alloc(nlev);
+    nBytes += sizeof(double)*nlev*(2*nlev + 2) + sizeof(size_t)*nlev;
+  }
+
+  ws->bandColli = malloc(sizeof(*(ws->bandColli))*par->nSpecies);
+  ws->bandRates = malloc(sizeof(*(ws->bandRates))*par->nSpecies);
+  for(ispec=0;ispec<par->nSpecies;ispec++){
+    if(statEqBands[ispec]==NULL){
+      ws->bandColli[ispec] = NULL;
+      ws->bandRates[ispec] = NULL;
+    }else{
+      nBand = md[ispec].nlev*(2*statEqBands[ispec]->bw + 1);
+      ws->bandColli[ispec] = malloc(sizeof(double)*nBand);
+      ws->bandRates[ispec] = malloc(sizeof(double)*nBand);
+      nBytes += 2*sizeof(double)*nBand;
+    }
+  }
+  ws->bandScratch = malloc(sizeof(*(ws->bandScratch))*2*ws->maxNlev);
+  nBytes += 2*sizeof(double)*ws->maxNlev;
+
+  ws->numBytes = nBytes;
+}
+
+/*....................................................................*/
+void
+_freeSolverWorkspace(const int nSpecies, solverWorkspace *ws){
+  int ispec;
+
+  if(ws->mp!= NULL){
+    for(ispec=0;ispec<nSpecies;ispec++){
+      free(ws->mp[ispec].jbar);
+      free(ws->mp[ispec].phot);
+      free(ws->mp[ispec].vfac);
+      free(ws->mp[ispec].vfac_loc);
     }
+    free(ws->mp);
+  }
+  free(ws->halfFirstDs);
+  free(ws->opop);
+  free(ws->oopop);
+  free(ws->tempNewPop);
+  free(ws->levScratch);
+  free(ws->ngHist);
+  free(ws->recInidir);
+  free(ws->recSegment);
+  free(ws->recStepStart);
+  free(ws->recNeighI);
+  free(ws->recDsOut);
+  free(ws->segmentOrder);
+  free(ws->lineScratch);
+  free(ws->jbVfacLoc);
+  free(ws->jbVfac);
+  free(ws->jbHalfDs);
+  free(ws->jbDTau);
+  free(ws->jbExpDTau);
+  free(ws->jbPhot);
+
+  for(ispec=0;ispec<nSpecies;ispec++){
+    gsl_matrix_free(ws->colli[ispec]);
+    gsl_matrix_free(ws->matrix[ispec]);
+    gsl_vector_free(ws->newpop[ispec]);
+    gsl_vector_free(ws->rhVec[ispec]);
+    gsl_permutation_free(ws->perm[ispec]);
+    free(ws->bandColli[ispec]);
+    free(ws->bandRates[ispec]);
   }
+  free(ws->colli);
+  free(ws->matrix);
+  free(ws->newpop);
+  free(ws->rhVec);
+  free(ws->perm);
+  free(ws->bandColli);
+  free(ws->bandRates);
+  free(ws->bandScratch);
 }
 
 /*....................................................................*/
@@ -512,40 +1294,72 @@ Pointers are indicated by a * before the attribute name and an arrow to the memo
 
 /*....................................................................*/
 void _calcGridCollRates(configInfo *par, molData *md, struct grid *gp){
-  int i,id,ipart,itrans,itemp,tnint=-1;
-  struct cpData part;
-  double fac;
+  /*
+Stores, for each grid point, species and collision partner, the index t_binlow of the tabulated temperature just below the point's temperature, and the fractional distance interp_coeff of the point's temperature between that and the next. The rates for all points and species are sections of a single slab, which starts at gp[0].mol[0].partner and is freed by _freeGridCollRates().
+  */
+  int i,id,ipart,lo,hi,mid,numPartTot,*partOffset;
+  struct rates *slab;
+  double temp;
 
+  partOffset = malloc(sizeof(*partOffset)*par->nSpecies);
+  numPartTot = 0;
   for(i=0;i<par->nSpecies;i++){
-    for(id=0;id<par->ncell;id++){
-      gp[id].mol[i].partner = malloc(sizeof(struct rates)*md[i].npart);
-    }
+    partOffset[i] = numPartTot;
+    numPartTot += md[i].npart;
+  }
+  slab = malloc(sizeof(*slab)*(numPartTot>0 ? numPartTot : 1)*(size_t)par->ncell);
 
-    for(ipart=0;ipart<md[i].npart;ipart++){
-      part = md[i].part[ipart];
-      for(id=0;id<par->ncell;id++){
-        for(itrans=0;itrans<part.ntrans;itrans++){
-          if((gp[id].t[0]>part.temp[0])&&(gp[id].t[0]<part.temp[part.ntemp-1])){
-            for(itemp=0;itemp<part.ntemp-1;itemp++){
-              if((gp[id].t[0]>part.temp[itemp])&&(gp[id].t[0]<=part.temp[itemp+1])){
-                tnint=itemp;
-              }
-            }
-            fac=(gp[id].t[0]-part.temp[tnint])/(part.temp[tnint+1]-part.temp[tnint]);
-            gp[id].mol[i].partner[ipart].t_binlow = tnint;
-            gp[id].mol[i].partner[ipart].interp_coeff = fac;
-
-	  } else if(gp[id].t[0]<=part.temp[0]) {
-	    gp[id].mol[i].partner[ipart].t_binlow = 0;
-	    gp[id].mol[i].partner[ipart].interp_coeff = 0.0;
-	  } else {
-	    gp[id].mol[i].partner[ipart].t_binlow = part.ntemp-2;
-	    gp[id].mol[i].partner[ipart].interp_coeff = 1.0;
-	  }
-        } /* End loop over transitions. */
-      } /* End loop over grid points. */
-    } /* End loop over collision partners. */
-  } /* End loop over radiating molecules. */
+  omp_set_dynamic(0);
+#pragma omp parallel for private(id,i,ipart,lo,hi,mid,temp) num_threads(par->nThreads)
+  for(id=0;id<par->ncell;id++){
+    temp = gp[id].t[0];
+    for(i=0;i<par->nSpecies;i++){
+      gp[id].mol[i].partner = slab + (size_t)id*numPartTot + partOffset[i];
+
+      for(ipart=0;ipart<md[i].npart;ipart++){
+        struct cpData *part = &md[i].part[ipart];
+
+        if((temp>part->temp[0])&&(temp<part->temp[part->ntemp-1])){
+          /* Binary search for temp[lo] < temp <= temp[lo+1]: */
+          lo = 0;
+          hi = part->ntemp-1;
+          while(hi-lo>1){
+            mid = (lo+hi)/2;
+            if(temp>part->temp[mid]) lo = mid;
+            else hi = mid;
+          }
+          gp[id].mol[i].partner[ipart].t_binlow = lo;
+          gp[id].mol[i].partner[ipart].interp_coeff = (temp-part->temp[lo])/(part->temp[lo+1]-part->temp[lo]);
+
+        } else if(temp<=part->temp[0]) {
+          gp[id].mol[i].partner[ipart].t_binlow = 0;
+          gp[id].mol[i].partner[ipart].interp_coeff = 0.0;
+        } else {
+          gp[id].mol[i].partner[ipart].t_binlow = part->ntemp-2;
+          gp[id].mol[i].partner[ipart].interp_coeff = 1.0;
+        }
+      } /* End loop over collision partners. */
+    } /* End loop over radiating molecules. */
+  } /* End loop over grid points. */
+
+  free(partOffset);
+}
+
+/*....................................................................*/
+void _freeGridCollRates(configInfo *par, struct grid *gp){
+  int id,si;
+
+  if(par->ncell<=0 || gp[0].mol==NULL)
+    return;
+
+  free(gp[0].mol[0].partner); /* I.e. the whole slab. */
+  for(id=0;id<par->ncell;id++){
+    if(gp[id].mol==NULL)
+      continue;
+
+    for(si=0;si<par->nSpecies;si++)
+      gp[id].mol[si].partner = NULL;
+  }
 }
 
 /*....................................................................*/
@@ -578,15 +1392,101 @@ void _freeGridCont(configInfo *par, struct grid *gp){
   }
 }
 
+/*....................................................................*/
+void
+_packHotGrid(configInfo *par, molData *md, struct grid *gp, struct hotGridData *hot){
+  /*
+Sets up the field-by-field copy of the grid data described at the definition of struct hotGridData. The per-point .pops, .specNumDens and .cont arrays are copied into the slabs and freed. The neighbour graph must have been built.
+  */
+  int id,si,nlev,nline;
+
+  hot->graph = gp[0].graph;
+  hot->x    = malloc(sizeof(*hot->x)   *par->ncell);
+  hot->vel  = malloc(sizeof(*hot->vel) *par->ncell);
+  hot->sink = malloc(sizeof(*hot->sink)*par->ncell);
+  hot->binv        = malloc(sizeof(*hot->binv)       *par->nSpecies);
+  hot->pops        = malloc(sizeof(*hot->pops)       *par->nSpecies);
+  hot->specNumDens = malloc(sizeof(*hot->specNumDens)*par->nSpecies);
+  hot->cont        = malloc(sizeof(*hot->cont)       *par->nSpecies);
+
+  for(id=0;id<par->ncell;id++){
+    memcpy(hot->x[id],   gp[id].x,   sizeof(hot->x[id]));
+    memcpy(hot->vel[id], gp[id].vel, sizeof(hot->vel[id]));
+    hot->sink[id] = (unsigned char)gp[id].sink;
+  }
+
+  for(si=0;si<par->nSpecies;si++){
+    nlev  = md[si].nlev;
+    nline = md[si].nline;
+    hot->binv[si]        = malloc(sizeof(**hot->binv)       *par->ncell);
+    hot->pops[si]        = calloc((size_t)par->ncell*nlev,  sizeof(**hot->pops));
+    hot->specNumDens[si] = calloc((size_t)par->ncell*nlev,  sizeof(**hot->specNumDens));
+    hot->cont[si]        = calloc((size_t)par->ncell*nline, sizeof(**hot->cont));
+
+    for(id=0;id<par->ncell;id++){
+      hot->binv[si][id] = gp[id].mol[si].binv;
+
+      if(gp[id].mol[si].pops!=NULL)
+        memcpy(hot->pops[si]+(size_t)id*nlev, gp[id].mol[si].pops, sizeof(**hot->pops)*nlev);
+      free(gp[id].mol[si].pops);
+      gp[id].mol[si].pops = hot->pops[si]+(size_t)id*nlev;
+
+      if(gp[id].mol[si].specNumDens!=NULL)
+        memcpy(hot->specNumDens[si]+(size_t)id*nlev, gp[id].mol[si].specNumDens, sizeof(**hot->specNumDens)*nlev);
+      free(gp[id].mol[si].specNumDens);
+      gp[id].mol[si].specNumDens = hot->specNumDens[si]+(size_t)id*nlev;
+
+      if(gp[id].mol[si].cont!=NULL)
+        memcpy(hot->cont[si]+(size_t)id*nline, gp[id].mol[si].cont, sizeof(**hot->cont)*nline);
+      free(gp[id].mol[si].cont);
+      gp[id].mol[si].cont = hot->cont[si]+(size_t)id*nline;
+    }
+  }
+}
+
+/*....................................................................*/
+void
+_unpackHotGrid(configInfo *par, molData *md, struct grid *gp, struct hotGridData *hot){
+  /*
+Gives the grid points their own copies of .pops and .specNumDens again, since other parts of LIME expect to be able to free these point by point, and frees the struct hotGridData. The .cont values, which are not needed after the solution, are discarded.
+  */
+  int id,si,nlev;
+
+  for(si=0;si<par->nSpecies;si++){
+    nlev = md[si].nlev;
+    for(id=0;id<par->ncell;id++){
+      gp[id].mol[si].pops        = malloc(sizeof(double)*nlev);
+      gp[id].mol[si].specNumDens = malloc(sizeof(double)*nlev);
+      memcpy(gp[id].mol[si].pops,        hot->pops[si]+(size_t)id*nlev,        sizeof(double)*nlev);
+      memcpy(gp[id].mol[si].specNumDens, hot->specNumDens[si]+(size_t)id*nlev, sizeof(double)*nlev);
+      gp[id].mol[si].cont = NULL;
+    }
+    free(hot->binv[si]);
+    free(hot->pops[si]);
+    free(hot->specNumDens[si]);
+    free(hot->cont[si]);
+  }
+  free(hot->binv);
+  free(hot->pops);
+  free(hot->specNumDens);
+  free(hot->cont);
+  free(hot->x);
+  free(hot->vel);
+  free(hot->sink);
+}
+
 /*....................................................................*/
 void _calcGridLinesDustOpacity(configInfo *par, molData *md, double *lamtab\
   , double *kaptab, const int nEntries, struct grid *gp){
-
-  int iline,id,si;
-  double *kappatab,gtd;
+  /*
+The gas-to-dust ratio is sampled once per grid point rather than once per point and species. The user function gasIIdust() may not be safe to call from several threads (it is not for python models), nor is the interpolation accelerator of the opacity spline, so these are done serially; the rest of the work is then done for all species in a single parallel pass over the grid points.
+  */
+  int iline,id,si,maxNLines;
+  double **kappatab,*gtds;
   gsl_spline *spline = NULL;
   gsl_interp_accel *acc = NULL;
   double *knus=NULL, *dusts=NULL;
+  double startTime=omp_get_wtime();
 
   if(par->dust != NULL){
     acc = gsl_interp_accel_alloc();
@@ -594,104 +1494,180 @@ void _calcGridLinesDustOpacity(configInfo *par, molData *md, double *lamtab\
     gsl_spline_init(spline,lamtab,kaptab,nEntries);
   }
 
+  maxNLines = 0;
+  kappatab = malloc(sizeof(*kappatab)*par->nSpecies);
   for(si=0;si<par->nSpecies;si++){
-    kappatab = malloc(sizeof(*kappatab)*md[si].nline);
-    knus     = malloc(sizeof(*knus)    *md[si].nline);
-    dusts    = malloc(sizeof(*dusts)   *md[si].nline);
-
+    kappatab[si] = malloc(sizeof(**kappatab)*md[si].nline);
     if(par->dust == NULL){
       for(iline=0;iline<md[si].nline;iline++)
-        kappatab[iline] = 0.;
+        kappatab[si][iline] = 0.;
     }else{
       for(iline=0;iline<md[si].nline;iline++)
-        kappatab[iline] = interpolateKappa(md[si].freq[iline]\
-                        , lamtab, kaptab, nEntries, spline, acc);
+        kappatab[si][iline] = interpolateKappa(md[si].freq[iline]\
+                            , lamtab, kaptab, nEntries, spline, acc);
     }
+    if(md[si].nline>maxNLines)
+      maxNLines = md[si].nline;
+  }
+
+  gtds = malloc(sizeof(*gtds)*par->ncell);
+  for(id=0;id<par->ncell;id++)
+    gasIIdust(gp[id].x[0],gp[id].x[1],gp[id].x[2],&gtds[id]);
+
+  omp_set_dynamic(0);
+#pragma omp parallel private(iline,id,si,knus,dusts) num_threads(par->nThreads)
+  {
+    knus  = malloc(sizeof(*knus) *maxNLines);
+    dusts = malloc(sizeof(*dusts)*maxNLines);
 
+#pragma omp for schedule(static)
     for(id=0;id<par->ncell;id++){
-      gasIIdust(gp[id].x[0],gp[id].x[1],gp[id].x[2],&gtd);
-      calcDustData(par, gp[id].dens, md[si].freq, gtd, kappatab, md[si].nline, gp[id].t, knus, dusts);
-      for(iline=0;iline<md[si].nline;iline++){
-        gp[id].mol[si].cont[iline].knu  = knus[iline];
-        gp[id].mol[si].cont[iline].dust = dusts[iline];
+      for(si=0;si<par->nSpecies;si++){
+        calcDustData(par, gp[id].dens, md[si].freq, gtds[id], kappatab[si], md[si].nline, gp[id].t, knus, dusts);
+        for(iline=0;iline<md[si].nline;iline++){
+          gp[id].mol[si].cont[iline].knu  = knus[iline];
+          gp[id].mol[si].cont[iline].dust = dusts[iline];
+        }
       }
     }
 
-    free(kappatab);
     free(knus);
     free(dusts);
-  }
+  } /* end parallel block. */
+
+  for(si=0;si<par->nSpecies;si++)
+    free(kappatab[si]);
+  free(kappatab);
+  free(gtds);
 
   if(par->dust != NULL){
     gsl_spline_free(spline);
     gsl_interp_accel_free(acc);
   }
+  addPrepTime(PREP_DUST_OPACITY, omp_get_wtime()-startTime);
+}
+
+/*....................................................................*/
+void
+_compactJBarPhotons(int posn, molData *md, struct grid *gp, const int molI\
+  , const solverWorkspace *photWs, solverWorkspace *ws){
+  /*
+Gathers, for the photons of grid point posn which have vfac_loc>0 (the only ones which contribute to jbar), vfac_loc, vfac and halfFirstDs into contiguous arrays, and transposes their intensities for species molI from the photon-major layout [iphot][lineI] of mp[molI].phot into a line-major layout [lineI][k]. This is done once per point and species, before the ALI loop in _solveStatEq(), since none of these quantities change within that loop. The photons are read from photWs, the workspace they were traced into, and the gathered arrays written to ws; these are different if the species is solved by another thread.
+
+Note that this is called from within the multi-threaded block.
+  */
+  int iphot,lineI,k=0;
+  const int nline=md[molI].nline;
+  const gridPointData *mp=photWs->mp;
+
+  ws->jbVsum = 0.;
+  for(iphot=0;iphot<gp[posn].nphot;iphot++){
+    if(mp[molI].vfac_loc[iphot]>0){
+      ws->jbVfacLoc[k] = mp[molI].vfac_loc[iphot];
+      ws->jbVfac[k]    = mp[molI].vfac[iphot];
+      ws->jbHalfDs[k]  = photWs->halfFirstDs[iphot];
+      ws->jbVsum += mp[molI].vfac_loc[iphot];
+      k++;
+    }
+  }
+  ws->jbNPhot = k;
+
+  for(lineI=0;lineI<nline;lineI++){
+    k = 0;
+    for(iphot=0;iphot<gp[posn].nphot;iphot++){
+      if(mp[molI].vfac_loc[iphot]>0)
+        ws->jbPhot[lineI*ws->jbNPhot + k++] = mp[molI].phot[lineI+iphot*nline];
+    }
+  }
 }
 
 /*....................................................................*/
 void
 _updateJBar(int posn, molData *md, struct grid *gp, const int molI\
   , configInfo *par, struct blendInfo blends, int nextMolWithBlend\
-  , gridPointData *mp, double *halfFirstDs){
+  , solverWorkspace *ws){
   /*
+Calculates mp[molI].jbar from the photons gathered by _compactJBarPhotons(). The emission and absorption coefficients are linear in vfac, so their line and blend parts are summed once per line with vfac=1 and scaled per photon. Then for each line, the optical depths of the first half-edges are calculated in one vectorizable pass, their exponentials in a second, and the weighted sum over photons in a third. Apart from round-off the result is the same as that of the original loop over photons and lines.
+
 Note that this is called from within the multi-threaded block.
   */
 
-  int lineI,iphot,bi,molJ,lineJ,nextLineWithBlend;
-  double dtau,expDTau,remnantSnu,vsum=0.;
-  
-  for(lineI=0;lineI<md[molI].nline;lineI++) mp[molI].jbar[lineI]=0.;
+  int lineI,k,bi,molJ,lineJ,nextLineWithBlend;
+  const int nAct=ws->jbNPhot;
+  const double taylorCutoff=par->taylorCutoff;
+  const double *vfacLoc=ws->jbVfacLoc,*vfac=ws->jbVfac,*halfDs=ws->jbHalfDs,*photLine;
+  double *dTau=ws->jbDTau,*expDTau=ws->jbExpDTau;
 
-  for(iphot=0;iphot<gp[posn].nphot;iphot++){
-    if(mp[molI].vfac_loc[iphot]>0){
-      nextLineWithBlend = 0;
-      for(lineI=0;lineI<md[molI].nline;lineI++){
-        double jnu=0.0;
-        double alpha=0;
+  nextLineWithBlend = 0;
+  for(lineI=0;lineI<md[molI].nline;lineI++){
+    double jnuPerVfac=0.,alphaPerVfac=0.,jnuCont=0.,alphaCont=0.,sum=0.;
 
-        sourceFunc_line(&md[molI],mp[molI].vfac[iphot],&(gp[posn].mol[molI]),lineI,&jnu,&alpha);
-        sourceFunc_cont(gp[posn].mol[molI].cont[lineI],&jnu,&alpha);
+    sourceFunc_line(&md[molI],1.0,&(gp[posn].mol[molI]),lineI,&jnuPerVfac,&alphaPerVfac);
+    sourceFunc_cont(gp[posn].mol[molI].cont[lineI],&jnuCont,&alphaCont);
 
-        /* Line blending part.
+    /* Line blending part.
+    */
+    if(par->blend && blends.mols!=NULL && molI==blends.mols[nextMolWithBlend].molI\
+    && lineI==blends.mols[nextMolWithBlend].lines[nextLineWithBlend].lineI){
+      for(bi=0;bi<blends.mols[nextMolWithBlend].lines[nextLineWithBlend].numBlends;bi++){
+        molJ  = blends.mols[nextMolWithBlend].lines[nextLineWithBlend].blends[bi].molJ;
+        lineJ = blends.mols[nextMolWithBlend].lines[nextLineWithBlend].blends[bi].lineJ;
+        /*
+        The next line is not quite correct, because vfac may be different for other molecules due to different values of binv. Unfortunately we don't necessarily have vfac for molJ available yet.
         */
-        if(par->blend && blends.mols!=NULL && molI==blends.mols[nextMolWithBlend].molI\
-        && lineI==blends.mols[nextMolWithBlend].lines[nextLineWithBlend].lineI){
-          for(bi=0;bi<blends.mols[nextMolWithBlend].lines[nextLineWithBlend].numBlends;bi++){
-            molJ  = blends.mols[nextMolWithBlend].lines[nextLineWithBlend].blends[bi].molJ;
-            lineJ = blends.mols[nextMolWithBlend].lines[nextLineWithBlend].blends[bi].lineJ;
-            /*
-            The next line is not quite correct, because vfac may be different for other molecules due to different values of binv. Unfortunately we don't necessarily have vfac for molJ available yet.
-            */
-            sourceFunc_line(&md[molJ],mp[molI].vfac[iphot],&(gp[posn].mol[molJ]),lineJ,&jnu,&alpha);
-	    /* note that sourceFunc* increment jnu and alpha, they don't overwrite it  */
-          }
+        sourceFunc_line(&md[molJ],1.0,&(gp[posn].mol[molJ]),lineJ,&jnuPerVfac,&alphaPerVfac);
+        /* note that sourceFunc* increment jnu and alpha, they don't overwrite it  */
+      }
 
-          nextLineWithBlend++;
-          if(nextLineWithBlend>=blends.mols[nextMolWithBlend].numLinesWithBlends){
-            nextLineWithBlend = 0;
-            /* The reason for doing this is as follows. Firstly, we only enter the present IF block if molI has at least 1 line which is blended with others; and further, if we have now processed all blended lines for that molecule. Thus no matter what value lineI takes for the present molecule, it won't appear as blends.mols[nextMolWithBlend].lines[i].lineI for any i. Yet we will still test blends.mols[nextMolWithBlend].lines[nextLineWithBlend], thus we want nextLineWithBlend to at least have a sensible value between 0 and blends.mols[nextMolWithBlend].numLinesWithBlends-1. We could set nextLineWithBlend to any number in this range in safety, but zero is simplest. */
-          }
-        }
-        /* End of line blending part */
+      nextLineWithBlend++;
+      if(nextLineWithBlend>=blends.mols[nextMolWithBlend].numLinesWithBlends){
+        nextLineWithBlend = 0;
+        /* See the comment at the equivalent place in _lineStepScalar(). */
+      }
+    }
+    /* End of line blending part */
 
-        dtau=alpha*halfFirstDs[iphot];
-        calcSourceFn(dtau, par, &remnantSnu, &expDTau);
-        remnantSnu *= jnu*halfFirstDs[iphot];
-        mp[molI].jbar[lineI]+=mp[molI].vfac_loc[iphot]*(expDTau*mp[molI].phot[lineI+iphot*md[molI].nline]+remnantSnu);
+#pragma omp simd
+    for(k=0;k<nAct;k++)
+      dTau[k] = (vfac[k]*alphaPerVfac + alphaCont)*halfDs[k];
 
-      }
-      vsum+=mp[molI].vfac_loc[iphot];
+    for(k=0;k<nAct;k++){
+#ifdef FASTEXP
+      expDTau[k] = FastExp(dTau[k]);
+#else
+      expDTau[k] = (fabs(dTau[k])<taylorCutoff) ? 0.0 : exp(-dTau[k]);
+#endif
+    }
+
+    photLine = ws->jbPhot + lineI*nAct;
+#pragma omp simd reduction(+:sum)
+    for(k=0;k<nAct;k++){
+      double remnantSnu,expD,taylorSnu;
+      int isTaylor;
+
+      isTaylor = (fabs(dTau[k])<taylorCutoff);
+      taylorSnu = 1. - dTau[k]*(1. - dTau[k]*(1./3.))*(1./2.);
+#ifdef FASTEXP
+      expD = expDTau[k];
+#else
+      expD = isTaylor ? 1. - dTau[k]*taylorSnu : expDTau[k];
+#endif
+      remnantSnu = isTaylor ? taylorSnu : (1.-expD)/dTau[k];
+      remnantSnu *= (vfac[k]*jnuPerVfac + jnuCont)*halfDs[k];
+      sum += vfacLoc[k]*(expD*photLine[k] + remnantSnu);
     }
+
+    ws->mp[molI].jbar[lineI] = sum/ws->jbVsum;
   }
-  for(lineI=0;lineI<md[molI].nline;lineI++) mp[molI].jbar[lineI] /= vsum;
 }
 
 /*....................................................................*/
 void
-_getFixedMatrix(molData *md, int ispec, struct grid *gp, int id, gsl_matrix *colli, configInfo *par){
+_getFixedMatrix(molData *md, int ispec, struct grid *gp, int id, gsl_matrix *colli\
+  , configInfo *par, double *scratch){
   int ipart,k,l,ti;
   /*
-Note that this is called from within the multi-threaded block.
+Note that this is called from within the multi-threaded block. The argument 'scratch' must have room for at least md[ispec].nlev values.
   */
 
   /* Initialize matrix with zeros */
@@ -723,16 +1699,15 @@ Note that this is called from within the multi-threaded block.
   }
 
   /* Does this work with >1 coll. part? */
-  double *ctot  = malloc(sizeof(double)*md[ispec].nlev);
+  double *ctot = scratch;
   for(k=0;k<md[ispec].nlev;k++){     
     ctot[k]=0.0;
     for(l=0;l<md[ispec].nlev;l++)
       ctot[k] += gsl_matrix_get(colli,l,k);
     gsl_matrix_set(colli,k,k,gsl_matrix_get(colli,k,k) - ctot[k]);
   }
-  free(ctot);
 
-  double *girtot = malloc(sizeof(double)*md[ispec].nlev);
+  double *girtot = scratch;
   if(par->girdatfile!=NULL){
     for(k=0;k<md[ispec].nlev;k++){
       girtot[k] = 0;
@@ -749,7 +1724,6 @@ Note that this is called from within the multi-threaded block.
       }
     }
   }
-  free(girtot);
 }
 
 /*....................................................................*/
@@ -774,6 +1748,293 @@ Note that this is called from within the multi-threaded block.
   }
 }
 
+/*....................................................................*/
+void
+_fillCollMatrixCache(configInfo *par, molData *md, struct grid *gp\
+  , solverWorkspace *workspaces, struct collMatrixCache *cache){
+  /*
+Works out which elements of the fixed matrix of each species can be non-zero, then calculates and stores the values of these for as many vertices as fit in cache->maxNumBytes. The thread-private colli matrices of the workspaces are used as scratch.
+  */
+  int ispec,ipart,ti,ei,k,l,n,id,threadI,maxNumCached;
+  unsigned char *mask;
+
+  cache->numElems      = malloc(sizeof(*(cache->numElems))     *par->nSpecies);
+  cache->elemRow       = malloc(sizeof(*(cache->elemRow))      *par->nSpecies);
+  cache->elemCol       = malloc(sizeof(*(cache->elemCol))      *par->nSpecies);
+  cache->speciesOffset = malloc(sizeof(*(cache->speciesOffset))*par->nSpecies);
+  cache->numValuesPerVertex = 0;
+  for(ispec=0;ispec<par->nSpecies;ispec++){
+    n = md[ispec].nlev;
+    mask = calloc((size_t)n*n, sizeof(*mask));
+    for(k=0;k<n;k++)
+      mask[k*n+k] = 1;
+    for(ipart=0;ipart<md[ispec].npart;ipart++){
+      if(md[ispec].part[ipart].densityIndex<0) continue;
+      for(ti=0;ti<md[ispec].part[ipart].ntrans;ti++){
+        k = md[ispec].part[ipart].lcl[ti];
+        l = md[ispec].part[ipart].lcu[ti];
+        mask[k*n+l] = 1;
+        mask[l*n+k] = 1;
+      }
+    }
+    if(par->girdatfile!=NULL){
+      for(k=0;k<n;k++){
+        for(l=0;l<n;l++){
+          if(md[ispec].gir[l*n+k]!=0.0)
+            mask[k*n+l] = 1;
+        }
+      }
+    }
+
+    cache->numElems[ispec] = 0;
+    for(k=0;k<n*n;k++)
+      if(mask[k]) cache->numElems[ispec]++;
+    cache->elemRow[ispec] = malloc(sizeof(**(cache->elemRow))*cache->numElems[ispec]);
+    cache->elemCol[ispec] = malloc(sizeof(**(cache->elemCol))*cache->numElems[ispec]);
+    ei = 0;
+    for(k=0;k<n;k++){
+      for(l=0;l<n;l++){
+        if(mask[k*n+l]){
+          cache->elemRow[ispec][ei] = k;
+          cache->elemCol[ispec][ei] = l;
+          ei++;
+        }
+      }
+    }
+    free(mask);
+
+    cache->speciesOffset[ispec] = cache->numValuesPerVertex;
+    cache->numValuesPerVertex += cache->numElems[ispec];
+  }
+
+  /* The vertices are cached in order of id until the memory budget is used up. */
+  maxNumCached = (int)gsl_min(cache->maxNumBytes/(sizeof(double)*cache->numValuesPerVertex), par->pIntensity);
+  cache->numCached = 0;
+  cache->numOverflow = 0;
+  for(id=0;id<par->pIntensity;id++){
+    if(gp[id].dens[0] > 0 && gp[id].t[0] > 0){
+      if(cache->numCached<maxNumCached) cache->numCached++;
+      else cache->numOverflow++;
+    }
+  }
+  cache->numBytes = sizeof(double)*cache->numValuesPerVertex*cache->numCached;
+  cache->block = malloc(cache->numBytes);
+  cache->values = malloc(sizeof(*(cache->values))*par->pIntensity);
+  n = 0;
+  for(id=0;id<par->pIntensity;id++){
+    if(gp[id].dens[0] > 0 && gp[id].t[0] > 0 && n<cache->numCached)
+      cache->values[id] = cache->block + (size_t)(n++)*cache->numValuesPerVertex;
+    else
+      cache->values[id] = NULL;
+  }
+
+  omp_set_dynamic(0);
+#pragma omp parallel private(id,ispec,threadI,ei) num_threads(par->nThreads)
+  {
+    threadI = omp_get_thread_num();
+    solverWorkspace *ws = &workspaces[threadI];
+
+#pragma omp for schedule(dynamic,64)
+    for(id=0;id<par->pIntensity;id++){
+      if(cache->values[id]==NULL) continue;
+      for(ispec=0;ispec<par->nSpecies;ispec++){
+        double *values = cache->values[id] + cache->speciesOffset[ispec];
+        _getFixedMatrix(md,ispec,gp,id,ws->colli[ispec],par,ws->levScratch);
+        for(ei=0;ei<cache->numElems[ispec];ei++)
+          values[ei] = gsl_matrix_get(ws->colli[ispec], cache->elemRow[ispec][ei], cache->elemCol[ispec][ei]);
+      }
+    }
+  } /* end parallel block. */
+}
+
+/*....................................................................*/
+void
+_freeCollMatrixCache(const int nSpecies, struct collMatrixCache *cache){
+  int ispec;
+
+  if(cache->values==NULL)
+    return;
+
+  for(ispec=0;ispec<nSpecies;ispec++){
+    free(cache->elemRow[ispec]);
+    free(cache->elemCol[ispec]);
+  }
+  free(cache->numElems);
+  free(cache->elemRow);
+  free(cache->elemCol);
+  free(cache->speciesOffset);
+  free(cache->values);
+  free(cache->block);
+  cache->values = NULL;
+}
+
+/*....................................................................*/
+void
+_getCachedFixedMatrix(struct collMatrixCache *cache, const int ispec, const int id, gsl_matrix *colli){
+  /*
+Restores the fixed matrix of species ispec at vertex id from the cache. Note that this is called from within the multi-threaded block.
+  */
+  int ei;
+  const double *values = cache->values[id] + cache->speciesOffset[ispec];
+
+  gsl_matrix_set_zero(colli);
+  for(ei=0;ei<cache->numElems[ispec];ei++)
+    gsl_matrix_set(colli, cache->elemRow[ispec][ei], cache->elemCol[ispec][ei], values[ei]);
+}
+
+/*....................................................................*/
+statEqBand*
+_buildStatEqBand(configInfo *par, molData *md, const int ispec){
+  /*
+Works out a renumbering of the levels of species ispec which brings the non-zero elements of its statistical-equilibrium matrix, as constructed by _getFixedMatrix() and _getMatrix(), into a narrow band about the diagonal. NULL is returned if the dense LU solver is to be used for this species instead, which is the case if par->statEqSolver==1, or if par->statEqSolver==0 and either the species has fewer than STATEQ_SPARSE_MIN_NLEV levels or the half-width of the band is more than a fraction STATEQ_SPARSE_MAX_BAND of the number of levels.
+  */
+  const int nlev=md[ispec].nlev;
+  int ipart,ti,li,k,l,bw;
+  unsigned char *mask;
+  statEqBand *seb;
+
+  if(par->statEqSolver==1 || (par->statEqSolver==0 && nlev<STATEQ_SPARSE_MIN_NLEV))
+    return NULL;
+
+  mask = calloc((size_t)nlev*nlev, sizeof(*mask));
+
+  for(ipart=0;ipart<md[ispec].npart;ipart++){
+    if(md[ispec].part[ipart].densityIndex<0) continue;
+    for(ti=0;ti<md[ispec].part[ipart].ntrans;ti++){
+      k = md[ispec].part[ipart].lcl[ti];
+      l = md[ispec].part[ipart].lcu[ti];
+      mask[k*nlev+l] = 1;
+      mask[l*nlev+k] = 1;
+    }
+  }
+
+  for(li=0;li<md[ispec].nline;li++){
+    k = md[ispec].lau[li];
+    l = md[ispec].lal[li];
+    mask[k*nlev+l] = 1;
+    mask[l*nlev+k] = 1;
+  }
+
+  if(par->girdatfile!=NULL){
+    for(k=0;k<nlev;k++){
+      for(l=0;l<nlev;l++){
+        if(k!=l && md[ispec].gir[l*nlev+k]!=0.0)
+          mask[k*nlev+l] = 1;
+      }
+    }
+  }
+
+  seb = malloc(sizeof(*seb));
+  seb->newIndex = malloc(sizeof(*(seb->newIndex))*nlev);
+  bw = sparseBandOrdering(nlev, mask, seb->newIndex);
+  free(mask);
+
+  if(par->statEqSolver==0 && bw>STATEQ_SPARSE_MAX_BAND*nlev){
+    free(seb->newIndex);
+    free(seb);
+    return NULL;
+  }
+  seb->bw = bw;
+
+  seb->lineIdx = malloc(sizeof(*(seb->lineIdx))*2*md[ispec].nline);
+  for(li=0;li<md[ispec].nline;li++){
+    k = seb->newIndex[md[ispec].lau[li]];
+    l = seb->newIndex[md[ispec].lal[li]];
+    seb->lineIdx[2*li  ] = SPARSE_BAND_INDEX(k,l,bw);
+    seb->lineIdx[2*li+1] = SPARSE_BAND_INDEX(l,k,bw);
+  }
+
+  return seb;
+}
+
+/*....................................................................*/
+void
+_freeStatEqBands(const int nSpecies, statEqBand **statEqBands){
+  int ispec;
+
+  if(statEqBands==NULL)
+    return;
+
+  for(ispec=0;ispec<nSpecies;ispec++){
+    if(statEqBands[ispec]!=NULL){
+      free(statEqBands[ispec]->newIndex);
+      free(statEqBands[ispec]->lineIdx);
+      free(statEqBands[ispec]);
+    }
+  }
+  free(statEqBands);
+}
+
+/*....................................................................*/
+void
+_getFixedBand(const int nlev, statEqBand *seb, gsl_matrix *colli, double *band){
+  /*
+Copies the off-diagonal elements of the fixed matrix colli, as filled by _getFixedMatrix(), to the band matrix of transition rates used by sparseGthSolve(). Element (k,l) of colli is minus the rate from level l to level k. Note that this is called from within the multi-threaded block.
+  */
+  int k,l,i,j;
+
+  memset(band, 0, sizeof(*band)*nlev*(2*seb->bw+1));
+  for(k=0;k<nlev;k++){
+    i = seb->newIndex[k];
+    for(l=0;l<nlev;l++){
+      j = seb->newIndex[l];
+      if(l!=k && abs(i-j)<=seb->bw)
+        band[SPARSE_BAND_INDEX(j,i,seb->bw)] = -gsl_matrix_get(colli,k,l);
+    }
+  }
+}
+
+/*....................................................................*/
+void
+_getBand(double *band, molData *md, int ispec, gridPointData *mp\
+  , statEqBand *seb, const double *colliBand){
+  /*
+The band equivalent of _getMatrix(). Note that this is called from within the multi-threaded block.
+  */
+  int li;
+
+  memcpy(band, colliBand, sizeof(*band)*md[ispec].nlev*(2*seb->bw+1));
+
+  for(li=0;li<md[ispec].nline;li++){
+    band[seb->lineIdx[2*li  ]] += md[ispec].beinstu[li]*mp[ispec].jbar[li]+md[ispec].aeinst[li];
+    band[seb->lineIdx[2*li+1]] += md[ispec].beinstl[li]*mp[ispec].jbar[li];
+  }
+}
+
+#ifdef TEST
+/*....................................................................*/
+void
+_checkStatEqSolvers(const int id, molData *md, const int ispec, gridPointData *mp\
+  , gsl_matrix *colli, gsl_matrix *matrix, gsl_permutation *p, gsl_vector *rhVec\
+  , gsl_vector *newpop){
+  /*
+Solves for the populations by dense LU decomposition and issues a warning if any population above 1e-6 differs from that in newpop, as found by the sparse solver, by more than 1e-8 relative. Note that matrix is overwritten.
+  */
+  const int nlev=md[ispec].nlev;
+  int s,t;
+  double luPops[nlev],maxRelDiff=0.0;
+  gsl_vector_view luView = gsl_vector_view_array(luPops, nlev);
+  char message[STR_LEN_0];
+
+  _getMatrix(matrix,md,ispec,mp,colli);
+  for(s=0;s<nlev;s++)
+    gsl_matrix_set(matrix,nlev-1,s,1.);
+
+  if(gsl_linalg_LU_decomp(matrix,p,&s) || gsl_linalg_LU_solve(matrix,p,rhVec,&luView.vector))
+    return;
+
+  for(t=0;t<nlev;t++){
+    if(luPops[t]>1.e-6)
+      maxRelDiff = gsl_max(maxRelDiff, fabs(gsl_vector_get(newpop,t)-luPops[t])/luPops[t]);
+  }
+
+  if(maxRelDiff>1.e-8 && !silent){
+    snprintf(message, STR_LEN_0, "Sparse and LU stat. eq. solutions differ by %.1e at point %d.", maxRelDiff, id);
+    warning(message);
+  }
+}
+#endif
+
 /*....................................................................*/
 void
 _lteOnePoint(molData *md, const int ispec, const double temp, double *pops){
@@ -802,33 +2063,216 @@ _LTE(configInfo *par, struct grid *gp, molData *md){
   if(par->outputfile) popsout(par,gp,md);
 }
 
+/*....................................................................*/
+double
+_sobolevVelGradient(struct grid *gp, const int id){
+  /*
+Estimates the magnitude of the local velocity gradient at grid point id as the average, over the Delaunay links of the point, of the difference in the velocity component along the link divided by the link length. For a velocity field proportional to radius this gives the exact value. Note that this is called from within the multi-threaded block.
+  */
+  int k,di;
+  double dvdr,dvAlong;
+  struct grid *neigh;
+
+  if(gp[id].numNeigh<=0)
+return 0.0;
+
+  dvdr = 0.0;
+  for(k=0;k<gp[id].numNeigh;k++){
+    neigh = gp[id].neigh[k];
+    dvAlong = 0.0;
+    for(di=0;di<DIM;di++)
+      dvAlong += (neigh->vel[di]-gp[id].vel[di])*(neigh->x[di]-gp[id].x[di]);
+    dvdr += fabs(dvAlong)/(gp[id].ds[k]*gp[id].ds[k]);
+  }
+
+  return dvdr/(double)gp[id].numNeigh;
+}
+
+/*....................................................................*/
+double
+_escapeProbability(const double tau){
+  /*
+The probability that a photon escapes from a Sobolev region of line-centre optical depth tau. Inverted populations (tau<0) are treated as optically thin.
+  */
+  if(tau<=0.0)
+return 1.0;
+  if(tau<1.0e-4)
+return 1.0 - 0.5*tau;
+  return (1.0 - exp(-tau))/tau;
+}
+
+/*....................................................................*/
+int
+_lvgOnePoint(configInfo *par, molData *md, struct grid *gp, const int id\
+  , const int ispec, const double dvdr, gsl_matrix *colli, gsl_matrix *matrix\
+  , gsl_vector *newpop, gsl_vector *rhVec, gsl_permutation *p, double *scratch\
+  , _Bool *converged){
+  /*
+Solves for the populations of species ispec at grid point id in the large velocity gradient (Sobolev) approximation, starting from those already in gp[id].mol[ispec].pops. The mean intensity of each line is taken to be (1-beta)*S+beta*I_cmb, where S is the line source function and beta the escape probability for the Sobolev optical depth given by the velocity gradient dvdr. Substituted into the rate equations, this reduces the radiative rates to beta times those for the CMB alone, with the Einstein A also multiplied by beta. Since beta depends on the populations, the equations are solved repeatedly until the populations change by less than TOL, or LVG_MAXITER times. The return value is the number of passes made. Dust is ignored, as are line blends.
+
+Note that this is called from within the multi-threaded block. The argument 'scratch' must have room for at least md[ispec].nlev values.
+  */
+  int t,s,li,k,l,iter,status;
+  double tau,beta,betaJ,betaA,diff,prevDiff,newValue;
+  _Bool damp;
+  double *pops=gp[id].mol[ispec].pops;
+  const double tauFactor = HPLANCK*CLIGHT/(4.0*M_PI)*gp[id].mol[ispec].nmol/dvdr;
+  const double minpop_for_convergence_check = 1.e-6;
+
+  _getFixedMatrix(md,ispec,gp,id,colli,par,scratch);
+  for(t=0;t<md[ispec].nlev;t++)
+    gsl_vector_set(rhVec,t,0.);
+  gsl_vector_set(rhVec,md[ispec].nlev-1,1.);
+
+  *converged = 0;
+  damp = 0;
+  prevDiff = 0.0;
+  iter = 0;
+  while(!(*converged) && iter<LVG_MAXITER){
+    gsl_matrix_memcpy(matrix, colli);
+    for(li=0;li<md[ispec].nline;li++){
+      k = md[ispec].lau[li];
+      l = md[ispec].lal[li];
+      tau = tauFactor*(pops[l]*md[ispec].beinstl[li] - pops[k]*md[ispec].beinstu[li]);
+      beta = _escapeProbability(tau);
+      betaJ = beta*md[ispec].cmb[li];
+      betaA = beta*md[ispec].aeinst[li];
+      gsl_matrix_set(matrix, k, k, gsl_matrix_get(matrix, k, k)+md[ispec].beinstu[li]*betaJ+betaA);
+      gsl_matrix_set(matrix, l, l, gsl_matrix_get(matrix, l, l)+md[ispec].beinstl[li]*betaJ);
+      gsl_matrix_set(matrix, k, l, gsl_matrix_get(matrix, k, l)-md[ispec].beinstl[li]*betaJ);
+      gsl_matrix_set(matrix, l, k, gsl_matrix_get(matrix, l, k)-md[ispec].beinstu[li]*betaJ-betaA);
+    }
+    for(s=0;s<md[ispec].nlev;s++)
+      gsl_matrix_set(matrix,md[ispec].nlev-1,s,1.);
+
+    status = gsl_linalg_LU_decomp(matrix,p,&s);
+    if(!status)
+      status = gsl_linalg_LU_solve(matrix,p,rhVec,newpop);
+    if(status){ /* Leave the populations as they were. */
+      iter++;
+  break;
+    }
+
+    /* When lines are moderately thick the populations can swing back and forth between passes; once the change stops shrinking, the new populations are averaged with the old ones. */
+    diff = 0.0;
+    for(t=0;t<md[ispec].nlev;t++){
+      newValue = gsl_max(gsl_vector_get(newpop,t),EPS);
+      if(damp)
+        newValue = 0.5*(newValue + pops[t]);
+      if(gsl_min(newValue,pops[t])>minpop_for_convergence_check)
+        diff = gsl_max(fabs(newValue-pops[t])/newValue, diff);
+      pops[t] = newValue;
+    }
+    iter++;
+    *converged = (iter>1 && diff<TOL);
+    if(iter>2 && diff>=prevDiff)
+      damp = 1;
+    prevDiff = diff;
+  }
+
+  return iter;
+}
+
+/*....................................................................*/
+void
+_LVG(configInfo *par, struct grid *gp, molData *md){
+  /*
+Sets the populations of all the non-sink grid points by _lvgOnePoint(), starting from LTE. The collision rates must have been calculated by _calcGridCollRates(). The points are independent of each other, so they are shared out among the threads.
+  */
+  int id,ispec,maxNlev,nPasses=0,nSolved=0,nUnconverged=0;
+  char message[STR_LEN_0];
+
+  maxNlev = 0;
+  for(ispec=0;ispec<par->nSpecies;ispec++)
+    if(md[ispec].nlev>maxNlev) maxNlev = md[ispec].nlev;
+
+  omp_set_dynamic(0);
+#pragma omp parallel private(id,ispec) num_threads(par->nThreads)
+  {
+    gsl_matrix *colli[par->nSpecies],*matrix[par->nSpecies];
+    gsl_vector *newpop[par->nSpecies],*rhVec[par->nSpecies];
+    gsl_permutation *p[par->nSpecies];
+    double scratch[maxNlev],dvdr,dvdrMin;
+    int iters,myPasses=0,mySolved=0,myUnconverged=0;
+    _Bool converged;
+
+    for(ispec=0;ispec<par->nSpecies;ispec++){
+      colli[ispec]  = gsl_matrix_alloc(md[ispec].nlev, md[ispec].nlev);
+      matrix[ispec] = gsl_matrix_alloc(md[ispec].nlev, md[ispec].nlev);
+      newpop[ispec] = gsl_vector_alloc(md[ispec].nlev);
+      rhVec[ispec]  = gsl_vector_alloc(md[ispec].nlev);
+      p[ispec]      = gsl_permutation_alloc(md[ispec].nlev);
+    }
+
+#pragma omp for schedule(dynamic,64)
+    for(id=0;id<par->pIntensity;id++){
+      dvdr = _sobolevVelGradient(gp, id);
+      for(ispec=0;ispec<par->nSpecies;ispec++){
+        _lteOnePoint(md, ispec, gp[id].t[0], gp[id].mol[ispec].pops);
+        if(!(gp[id].dens[0] > 0 && gp[id].t[0] > 0 && gp[id].mol[ispec].nmol > 0))
+      continue;
+
+        /* A region with no velocity gradient is treated as extending over the model radius. */
+        dvdrMin = 1.0/(gp[id].mol[ispec].binv*par->radius);
+        iters = _lvgOnePoint(par, md, gp, id, ispec, gsl_max(dvdr, dvdrMin), colli[ispec], matrix[ispec]\
+          , newpop[ispec], rhVec[ispec], p[ispec], scratch, &converged);
+        myPasses += iters;
+        mySolved++;
+        if(!converged) myUnconverged++;
+      }
+    }
+
+    for(ispec=0;ispec<par->nSpecies;ispec++){
+      gsl_matrix_free(colli[ispec]);
+      gsl_matrix_free(matrix[ispec]);
+      gsl_vector_free(newpop[ispec]);
+      gsl_vector_free(rhVec[ispec]);
+      gsl_permutation_free(p[ispec]);
+    }
+
+#pragma omp atomic
+    nPasses += myPasses;
+#pragma omp atomic
+    nSolved += mySolved;
+#pragma omp atomic
+    nUnconverged += myUnconverged;
+  } /* end parallel block. */
+
+  if(!silent && nSolved>0){
+    snprintf(message, STR_LEN_0, "LVG populations: mean %.1f passes per point and species; %d of %d not converged.", nPasses/(double)nSolved, nUnconverged, nSolved);
+    printMessage(message);
+  }
+}
+
 /*....................................................................*/
 void
 _solveStatEq(int id, struct grid *gp, molData *md, const int ispec, configInfo *par\
-  , struct blendInfo blends, int nextMolWithBlend, gridPointData *mp\
-  , double *halfFirstDs, _Bool *luWarningGiven){
+  , struct blendInfo blends, int nextMolWithBlend, solverWorkspace *ws\
+  , const solverWorkspace *photWs, statEqBand *seb, struct collMatrixCache *collCache\
+  , const double aliTol, const int aliMinIters, _Bool *luWarningGiven, _Bool *sparseWarningGiven){
   /*
-Note that this is called from within the multi-threaded block.
+Note that this is called from within the multi-threaded block. The photons of the point are read from photWs; all the other working storage is taken from ws, which must belong to the calling thread.
+
+If seb is not NULL, the transition rates are assembled in band form and solved by sparseGthSolve(). Should that fail, the dense LU solver is used instead.
+
+The ALI iterations stop when the largest relative change in the populations is less than aliTol, but not before aliMinIters have been done, nor after MAXITER. The change after the 1st iteration is measured from the populations the point had on entry, so with aliMinIters=1 a single iteration is done only if that change is already less than aliTol.
   */
 
   int t,s,iter,status;
-  double *opop,*oopop,*tempNewPop=NULL;
+  _Bool useLU;
+  double *opop=ws->opop,*oopop=ws->oopop,*tempNewPop=ws->tempNewPop;
   double diff;
   const double minpop_for_convergence_check = 1.e-6;
   char errStr[80];
 
-  gsl_matrix *colli  = gsl_matrix_alloc(md[ispec].nlev, md[ispec].nlev);
-  gsl_matrix *matrix = gsl_matrix_alloc(md[ispec].nlev, md[ispec].nlev);
-  gsl_vector *newpop = gsl_vector_alloc(md[ispec].nlev);
-  gsl_vector *rhVec  = gsl_vector_alloc(md[ispec].nlev);
-  gsl_permutation *p = gsl_permutation_alloc (md[ispec].nlev);
-
-  opop       = malloc(sizeof(*opop)      *md[ispec].nlev);
-  oopop      = malloc(sizeof(*oopop)     *md[ispec].nlev);
-  tempNewPop = malloc(sizeof(*tempNewPop)*md[ispec].nlev);
+  gsl_matrix *colli  = ws->colli[ispec];
+  gsl_matrix *matrix = ws->matrix[ispec];
+  gsl_vector *newpop = ws->newpop[ispec];
+  gsl_vector *rhVec  = ws->rhVec[ispec];
+  gsl_permutation *p = ws->perm[ispec];
 
   for(t=0;t<md[ispec].nlev;t++){
-    opop[t]=0.;
+    opop[t]=gp[id].mol[ispec].pops[t]; /* So that the change can be measured after the 1st iteration. */
     oopop[t]=0.;
     gsl_vector_set(rhVec,t,0.);
   }
@@ -836,38 +2280,65 @@ Note that this is called from within the multi-threaded block.
   diff=1;
   iter=0;
 
-  _getFixedMatrix(md,ispec,gp,id,colli,par);
-
-  while((diff>TOL && iter<MAXITER) || iter<5){
-    _updateJBar(id,md,gp,ispec,par,blends,nextMolWithBlend,mp,halfFirstDs);
+  if(collCache!=NULL && collCache->values[id]!=NULL)
+    _getCachedFixedMatrix(collCache,ispec,id,colli);
+  else
+    _getFixedMatrix(md,ispec,gp,id,colli,par,ws->levScratch);
+  if(seb!=NULL)
+    _getFixedBand(md[ispec].nlev,seb,colli,ws->bandColli[ispec]);
+  _compactJBarPhotons(id,md,gp,ispec,photWs,ws);
+
+  while((diff>aliTol && iter<MAXITER) || iter<aliMinIters){
+    _updateJBar(id,md,gp,ispec,par,blends,nextMolWithBlend,ws);
+
+    useLU = 1;
+    if(seb!=NULL){
+      _getBand(ws->bandRates[ispec],md,ispec,ws->mp,seb,ws->bandColli[ispec]);
+      status = sparseGthSolve(md[ispec].nlev,seb->bw,ws->bandRates[ispec],ws->bandScratch,ws->bandScratch+ws->maxNlev);
+      if(status==SPARSE_OK){
+        useLU = 0;
+        for(s=0;s<md[ispec].nlev;s++)
+          gsl_vector_set(newpop,s,ws->bandScratch[seb->newIndex[s]]);
+#ifdef TEST
+        _checkStatEqSolvers(id,md,ispec,ws->mp,colli,matrix,p,rhVec,newpop);
+#endif
+      }else if(!silent && !(*sparseWarningGiven)){
+        *sparseWarningGiven = 1;
+        sprintf(errStr, "Sparse solver failed for point %d, iteration %d (error %d).", id, iter, status);
+        warning(errStr);
+        warning("Using LU for this point. NOTE that no further warnings will be issued.");
+      }
+    }
 
-    _getMatrix(matrix,md,ispec,mp,colli);
+    if(useLU){
+      _getMatrix(matrix,md,ispec,ws->mp,colli);
 
-    /* this could also be done in _getFixedMatrix */ 
-    for(s=0;s<md[ispec].nlev;s++){
-      gsl_matrix_set(matrix,md[ispec].nlev-1,s,1.);
-    }
+      /* this could also be done in _getFixedMatrix */ 
+      for(s=0;s<md[ispec].nlev;s++){
+        gsl_matrix_set(matrix,md[ispec].nlev-1,s,1.);
+      }
 
-    status = gsl_linalg_LU_decomp(matrix,p,&s);
-    if(status){
-      if(!silent){
-        sprintf(errStr, "LU decomposition failed for point %d, iteration %d (GSL error %d).", id, iter, status);
-        bail_out(errStr);
+      status = gsl_linalg_LU_decomp(matrix,p,&s);
+      if(status){
+        if(!silent){
+          sprintf(errStr, "LU decomposition failed for point %d, iteration %d (GSL error %d).", id, iter, status);
+          bail_out(errStr);
+        }
+        exit(1);
       }
-      exit(1);
-    }
 
-    status = gsl_linalg_LU_solve(matrix,p,rhVec,newpop);
-    if(status){
-      if(!silent && !(*luWarningGiven)){
-        *luWarningGiven = 1;
-        sprintf(errStr, "LU solver failed for point %d, iteration %d (GSL error %d).", id, iter, status);
-        warning(errStr);
-        warning("Doing LSE for this point. NOTE that no further warnings will be issued.");
+      status = gsl_linalg_LU_solve(matrix,p,rhVec,newpop);
+      if(status){
+        if(!silent && !(*luWarningGiven)){
+          *luWarningGiven = 1;
+          sprintf(errStr, "LU solver failed for point %d, iteration %d (GSL error %d).", id, iter, status);
+          warning(errStr);
+          warning("Doing LSE for this point. NOTE that no further warnings will be issued.");
+        }
+        _lteOnePoint(md, ispec, gp[id].t[0], tempNewPop);
+        for(s=0;s<md[ispec].nlev;s++)
+          gsl_vector_set(newpop,s,tempNewPop[s]);
       }
-      _lteOnePoint(md, ispec, gp[id].t[0], tempNewPop);
-      for(s=0;s<md[ispec].nlev;s++)
-        gsl_vector_set(newpop,s,tempNewPop[s]);
     }
 
     diff=0.;
@@ -889,26 +2360,159 @@ Note that this is called from within the multi-threaded block.
     iter++;
   }
 
-  gsl_matrix_free(colli);
-  gsl_matrix_free(matrix);
-  gsl_vector_free(rhVec);
-  gsl_vector_free(newpop);
-  gsl_permutation_free(p);
-  free(tempNewPop);
-  free(opop);
-  free(oopop);
+  ws->nAliSolves++;
+  ws->nAliIters += iter;
+}
+
+/*....................................................................*/
+void
+_sortVerticesByColour(const int numVertices, const int *colour, const int numColours\
+  , size_t *vertexOrder, int *colourStart){
+  /*
+Rearranges the list of vertices in vertexOrder so that those of colour 0 come first, followed by those of colour 1, etc., without changing the order of the vertices of the same colour. On return, the vertices of colour c are vertexOrder[colourStart[c]] to vertexOrder[colourStart[c+1]-1].
+  */
+  int c,j,*next;
+  size_t *sorted;
+
+  for(c=0;c<=numColours;c++)
+    colourStart[c] = 0;
+  for(j=0;j<numVertices;j++)
+    colourStart[colour[vertexOrder[j]]+1]++;
+  for(c=0;c<numColours;c++)
+    colourStart[c+1] += colourStart[c];
+
+  next   = malloc(sizeof(*next)  *numColours);
+  sorted = malloc(sizeof(*sorted)*numVertices);
+  memcpy(next, colourStart, sizeof(*next)*numColours);
+  for(j=0;j<numVertices;j++)
+    sorted[next[colour[vertexOrder[j]]]++] = vertexOrder[j];
+  memcpy(vertexOrder, sorted, sizeof(*vertexOrder)*numVertices);
+
+  free(next);
+  free(sorted);
+}
+
+/*....................................................................*/
+void
+_calcPointSpecNumDens(configInfo *par, molData *md, struct grid *gp, const int id){
+  /*
+The same as calcGridMolSpecNumDens(), but for just the one grid point.
+  */
+  int ispec,ilev;
+
+  for(ispec=0;ispec<par->nSpecies;ispec++){
+    for(ilev=0;ilev<md[ispec].nlev;ilev++)
+      gp[id].mol[ispec].specNumDens[ilev] = gp[id].mol[ispec].binv\
+        *gp[id].mol[ispec].nmol*gp[id].mol[ispec].pops[ilev];
+  }
+}
+
+/*....................................................................*/
+double
+_getHistPop(const struct statistics *stat, const size_t i){
+return (stat->popF!=NULL) ? (double)stat->popF[i] : stat->pop[i];
+}
+
+/*....................................................................*/
+void
+_setHistPop(struct statistics *stat, const size_t i, const double value){
+  if(stat->popF!=NULL)
+    stat->popF[i] = (float)value;
+  else
+    stat->pop[i] = value;
+}
+
+/*....................................................................*/
+const double*
+_getHistRow(const struct statistics *stat, const size_t start, const int nlev, double *buffer){
+  /*
+Returns a pointer to nlev values of the population history, beginning at entry start, as doubles. In mixed-precision mode these are converted into buffer, which must have room for nlev values; otherwise the history itself is pointed to.
+  */
+  int ilev;
+
+  if(stat->popF==NULL)
+return stat->pop + start;
+
+  for(ilev=0;ilev<nlev;ilev++)
+    buffer[ilev] = (double)stat->popF[start+ilev];
+
+return buffer;
+}
+
+/*....................................................................*/
+_Bool
+_ngExtrapolate(const int nlev, double *pops, const double *x1, const double *x2, const double *x3, double *scratch){
+  /*
+Replaces the populations in pops with the order-2 Ng extrapolation (Ng 1974, J. Chem. Phys. 61, 2680; Auer 1987) formed from pops and the three previous iterates x1 (most recent), x2 and x3. The differences are weighted by 1/pops^2 so that each level counts according to its relative rather than its absolute change.
+
+Since the combination coefficients sum to 1, the extrapolated populations remain normalized. If the 2x2 system is ill-conditioned, or any extrapolated population is not positive, pops is left untouched and FALSE is returned.
+  */
+
+  double a11=0.0,a12=0.0,a22=0.0,b1=0.0,b2=0.0,d0,d1,d2,w,det,ca,cb;
+  int ilev;
+
+  for(ilev=0;ilev<nlev;ilev++){
+    if(pops[ilev]<=0.0)
+return 0;
+
+    w  = 1.0/(pops[ilev]*pops[ilev]);
+    d0 = pops[ilev] - x1[ilev];
+    d1 = d0 - (x1[ilev] - x2[ilev]);
+    d2 = d0 - (x2[ilev] - x3[ilev]);
+    a11 += w*d1*d1;
+    a12 += w*d1*d2;
+    a22 += w*d2*d2;
+    b1  += w*d0*d1;
+    b2  += w*d0*d2;
+  }
+
+  det = a11*a22 - a12*a12;
+  if(fabs(det)<=1.0e-10*a11*a22 || det==0.0)
+return 0;
+
+  ca = (b1*a22 - b2*a12)/det;
+  cb = (b2*a11 - b1*a12)/det;
+
+  for(ilev=0;ilev<nlev;ilev++){
+    scratch[ilev] = (1.0 - ca - cb)*pops[ilev] + ca*x1[ilev] + cb*x2[ilev];
+    if(!(scratch[ilev]>0.0)) /* Also catches NaN. */
+return 0;
+  }
+
+  for(ilev=0;ilev<nlev;ilev++)
+    pops[ilev] = scratch[ilev];
+
+return 1;
 }
 
 /*....................................................................*/
 int
 levelPops(molData *md, configInfo *par, struct grid *gp, int *popsdone, double *lamtab, double *kaptab, const int nEntries){
-  int id,iter,ilev,ispec,c=0,n,i,threadI,nVerticesDone,nItersDone,nlinetot,nExtraSolverIters=0;
+  int id,iter,ilev,ispec,c=0,n,i,threadI,nVerticesDone,nItersDone,nlinetot,nExtraSolverIters=0,maxNphot;
+  int nlevtot,histNSpecies,levOffset,nNgAccepted,nNgRejected,nConverged,nActive,j,iterThisRun,newMaxNphot;
+  double *photWeights=NULL;
+  double maxRelChange,fracConverged,aliTol;
+  int aliMinIters;
+  _Bool doNgThisIter,useConvCriteria,tightFinalIter=0;
+  const double minpop_for_convergence_check = 1.e-6;
   double percent=0.,*median,result1=0,result2=0,snr,delta_pop;
-  int nextMolWithBlend,nMaserWarnings=0,totalNMaserWarnings=0;
-  struct statistics { double *pop, *ave, *sigma; } *stat;
-  const gsl_rng_type *ranNumGenType = gsl_rng_ranlxs2;
+  solverWorkspace *workspaces=NULL;
+  size_t peakWorkspaceBytes;
+  struct photonPathCache pathCache,*pathCachePtr=NULL;
+  struct collMatrixCache collCache,*collCachePtr=NULL;
+  struct hotGridData hotGrid;
+  int nMaserWarnings=0,totalNMaserWarnings=0;
+  struct statistics *stat;
+  const gsl_rng_type *ranNumGenType = rngTypeFromPar(par->rngType);
+  unsigned long streamSeed=0;
+  double *vertexCost=NULL,threadBusy[par->nThreads],minBusy,maxBusy,sumBusy;
+  size_t *vertexOrder=NULL;
+  int *vertexColour=NULL,numColours=1,*colourStart=NULL;
+  _Bool useCostOrder;
   struct blendInfo blends;
-  _Bool luWarningGiven=0;
+  struct speciesGroups speciesGroups;
+  _Bool luWarningGiven=0,sparseWarningGiven=0;
+  statEqBand **statEqBands=NULL;
   gsl_error_handler_t *defaultErrorHandler=NULL;
   int RNG_seeds[par->nThreads];
   char message[STR_LEN_0];
@@ -928,6 +2532,14 @@ levelPops(molData *md, configInfo *par, struct grid *gp, int *popsdone, double *
     _LTE(par,gp,md);
     if(par->outputfile) popsout(par,gp,md);
 
+  }else if(par->lvg_only){
+    _calcGridCollRates(par,md,gp);
+    defaultErrorHandler = gsl_set_error_handler_off(); /* So that a failed LU solve in _lvgOnePoint() leaves the point as it was rather than aborting. */
+    _LVG(par,gp,md);
+    gsl_set_error_handler(defaultErrorHandler);
+    _freeGridCollRates(par, gp);
+    if(par->outputfile) popsout(par,gp,md);
+
   }else{ /* Non-LTE */
     stat=malloc(sizeof(struct statistics)*par->pIntensity);
 
@@ -938,6 +2550,10 @@ levelPops(molData *md, configInfo *par, struct grid *gp, int *popsdone, double *
     else 
       gsl_rng_set(ran,time(0));
 
+    /* With the counter-based generator, each vertex gets its own stream at each iteration, so that the results do not depend on which thread handles it. */
+    if(par->rngType==RNG_PHILOX)
+      streamSeed = gsl_rng_get(ran);
+
     gsl_rng **threadRans;
     threadRans = malloc(sizeof(gsl_rng *)*par->nThreads);
 
@@ -951,23 +2567,106 @@ levelPops(molData *md, configInfo *par, struct grid *gp, int *popsdone, double *
     _freeGridCont(par, gp);
     _mallocGridCont(par, md, gp);
     _calcGridLinesDustOpacity(par, md, lamtab, kaptab, nEntries, gp);
+    if(par->mixedPrecision)
+      freeNeighGraphDirs((unsigned long)par->ncell, gp);
+    _packHotGrid(par, md, gp, &hotGrid);
 
     /* Check for blended lines */
     _lineBlend(md, par, &blends);
+    _groupSpecies(par, blends, &speciesGroups);
 
     if(par->init_lte) _LTE(par,gp,md);
+    else if(par->init_lvg){
+      defaultErrorHandler = gsl_set_error_handler_off(); /* See the lvg_only case above. */
+      _LVG(par,gp,md);
+      gsl_set_error_handler(defaultErrorHandler);
+    }
+
+    /* The SNR statistics only look at species 0, so by default the population history is kept for that species alone. Ng acceleration, and the relative changes used by the active set and by par->convMaxRelChange, need it for all species, in which case it holds them all, concatenated, species 0 coming first. nlevtot is the length of one iteration's worth of history.
+    */
+    histNSpecies = (par->doNgAccel || par->freezeTol>0.0 || par->convMaxRelChange>0.0) ? par->nSpecies : 1;
+    nlevtot = 0;
+    for(ispec=0;ispec<histNSpecies;ispec++)
+      nlevtot += md[ispec].nlev;
 
     for(id=0;id<par->pIntensity;id++){
-      stat[id].pop=malloc(sizeof(double)*md[0].nlev*5);
+      if(par->mixedPrecision){
+        stat[id].pop=NULL;
+        stat[id].popF=malloc(sizeof(float)*nlevtot*5);
+      }else{
+        stat[id].pop=malloc(sizeof(double)*nlevtot*5);
+        stat[id].popF=NULL;
+      }
       stat[id].ave=malloc(sizeof(double)*md[0].nlev);
       stat[id].sigma=malloc(sizeof(double)*md[0].nlev);
-      for(ilev=0;ilev<md[0].nlev;ilev++) {
-        for(iter=0;iter<5;iter++) stat[id].pop[ilev+md[0].nlev*iter]=gp[id].mol[0].pops[ilev];
+      stat[id].relChange = -1.0; /* I.e. not yet known. */
+      stat[id].frozen = 0;
+      levOffset = 0;
+      for(ispec=0;ispec<histNSpecies;ispec++){
+        for(ilev=0;ilev<md[ispec].nlev;ilev++) {
+          for(iter=0;iter<5;iter++) _setHistPop(&stat[id], levOffset+ilev+nlevtot*iter, gp[id].mol[ispec].pops[ilev]);
+        }
+        levOffset += md[ispec].nlev;
       }
     }
 
     if(par->outputfile) popsout(par,gp,md);
 
+    /* Species with many levels but few transitions per level may use the sparse solver. */
+    statEqBands = malloc(sizeof(*statEqBands)*par->nSpecies);
+    for(ispec=0;ispec<par->nSpecies;ispec++){
+      statEqBands[ispec] = _buildStatEqBand(par, md, ispec);
+      if(!silent && statEqBands[ispec]!=NULL){
+        snprintf(message, STR_LEN_0, "Species %d: sparse stat. eq. solver, band half-width %d of %d levels.", ispec, statEqBands[ispec]->bw, md[ispec].nlev);
+        printMessage(message);
+      }
+    }
+
+    /* Allocate the thread-private working storage once, for the whole of the solution run.
+    */
+    maxNphot = 0;
+    for(id=0;id<par->pIntensity;id++)
+      if(gp[id].nphot>maxNphot) maxNphot = gp[id].nphot;
+
+    workspaces = malloc(sizeof(*workspaces)*par->nThreads);
+    peakWorkspaceBytes = 0;
+    for(i=0;i<par->nThreads;i++){
+      _mallocSolverWorkspace(par, md, maxNphot, statEqBands, &workspaces[i]);
+      if(workspaces[i].numBytes>peakWorkspaceBytes) peakWorkspaceBytes = workspaces[i].numBytes;
+    }
+    if(!silent){
+      snprintf(message, STR_LEN_0, "Solver workspace: %.1f kB per thread.", peakWorkspaceBytes/1024.0);
+      printMessage(message);
+    }
+
+    if(par->nPhotMax>0)
+      photWeights = malloc(sizeof(*photWeights)*par->pIntensity);
+
+    /* The photon path cache is filled during the first iteration in which each vertex is solved. */
+    pathCache.vertices = NULL;
+    if(par->pathCacheMB>0.0){
+      pathCache.vertices = malloc(sizeof(*(pathCache.vertices))*par->pIntensity);
+      for(id=0;id<par->pIntensity;id++)
+        pathCache.vertices[id].status = 0;
+      pathCache.numBytes = 0;
+      pathCache.maxNumBytes = (size_t)(par->pathCacheMB*1024.0*1024.0);
+      pathCache.numCached = 0;
+      pathCache.numOverflow = 0;
+      pathCachePtr = &pathCache;
+    }
+
+    /* The collisional part of the matrices does not change from one iteration to the next. */
+    collCache.values = NULL;
+    if(par->collCacheMB>0.0){
+      collCache.maxNumBytes = (size_t)(par->collCacheMB*1024.0*1024.0);
+      _fillCollMatrixCache(par, md, gp, workspaces, &collCache);
+      collCachePtr = &collCache;
+      if(!silent){
+        snprintf(message, STR_LEN_0, "Collision matrix cache: %d points, %.1f MB; %d points did not fit.", collCache.numCached, collCache.numBytes/1048576.0, collCache.numOverflow);
+        printMessage(message);
+      }
+    }
+
     /* Initialize convergence flag */
     for(id=0;id<par->ncell;id++){
       gp[id].conv=0;
@@ -980,96 +2679,290 @@ This is done to allow proper handling of errors which may arise in the LU solver
 While this is off however, other gsl_* etc calls will not exit if they encounter a problem. We may need to pay some attention to trapping their errors.
     */
 
+    /* Vertices are handed out in decreasing order of cost, which is taken to be the time each took when last solved; before the first iteration its number of photons serves instead. */
+    useCostOrder = (par->solverSchedule==2 || (par->solverSchedule==0 && par->rngType==RNG_PHILOX));
+    vertexCost  = malloc(sizeof(*vertexCost) *par->pIntensity);
+    vertexOrder = malloc(sizeof(*vertexOrder)*par->pIntensity);
+    for(id=0;id<par->pIntensity;id++){
+      vertexCost[id] = (gp[id].dens[0] > 0 && gp[id].t[0] > 0) ? (double)gp[id].nphot : 0.0;
+      vertexOrder[id] = (size_t)id;
+    }
+
+    /* With par->solverUpdate==SOLVER_UPDATE_COLOURS the vertices are solved colour by colour, and the species number densities of each colour are updated before the next is started, so that the photons of later colours see the populations already found in the present iteration, as in Gauss-Seidel iteration. Since no two neighbours have the same colour, each vertex sees the new populations of at least some of its neighbours. */
+    colourStart = malloc(sizeof(*colourStart)*2);
+    colourStart[0] = 0;
+    colourStart[1] = par->pIntensity;
+    if(par->solverUpdate==SOLVER_UPDATE_COLOURS){
+      vertexColour = malloc(sizeof(*vertexColour)*par->ncell);
+      numColours = colourNeighGraph((unsigned long)par->ncell, gp, vertexColour);
+      free(colourStart);
+      colourStart = malloc(sizeof(*colourStart)*(numColours+1));
+      if(!silent){
+        snprintf(message, STR_LEN_0, "Grid points solved in %d colour groups.", numColours);
+        printMessage(message);
+      }
+    }
+
+    useConvCriteria = (par->convMedianSNR>0.0 || par->convFracConverged>0.0 || par->convMaxRelChange>0.0);
+    par->solverConverged = 0;
+
     nItersDone = par->nSolveItersDone;
-    while(nItersDone < par->nSolveIters){ /* Not a 'for' loop because we will probably later want to add a convergence criterion. */
+    while(nItersDone < par->nSolveIters && !par->solverConverged){
       if(!silent) progressbar2(par->nSolveIters, 0, nItersDone, 0, result1, result2);
 
+      /* The populations of points frozen in the last iteration have not changed, so their history is left as it was. Otherwise it would fill with copies of the same values, their sigma would fall towards 0 and the SNR and convergence statistics below would count them as ever better converged. As it is, these statistics keep the values from the last iteration in which the points were solved.
+      */
       for(id=0;id<par->pIntensity;id++){
-        for(ilev=0;ilev<md[0].nlev;ilev++) {
-          for(iter=0;iter<4;iter++) stat[id].pop[ilev+md[0].nlev*iter]=stat[id].pop[ilev+md[0].nlev*(iter+1)];
-          stat[id].pop[ilev+md[0].nlev*4]=gp[id].mol[0].pops[ilev];
+        if(stat[id].frozen) continue;
+
+        levOffset = 0;
+        for(ispec=0;ispec<histNSpecies;ispec++){
+          for(ilev=0;ilev<md[ispec].nlev;ilev++) {
+            for(iter=0;iter<4;iter++) _setHistPop(&stat[id], levOffset+ilev+nlevtot*iter, _getHistPop(&stat[id], levOffset+ilev+nlevtot*(iter+1)));
+            _setHistPop(&stat[id], levOffset+ilev+nlevtot*4, gp[id].mol[ispec].pops[ilev]);
+          }
+          levOffset += md[ispec].nlev;
         }
       }
       calcGridMolSpecNumDens(par,md,gp);
 
+      iterThisRun = nItersDone - par->nSolveItersDone;
+
+      /* Ng extrapolation needs 3 iterates from the present run in the history besides the one about to be calculated. */
+      doNgThisIter = (par->doNgAccel && (iterThisRun+1)%NG_ACCEL_PERIOD==0);
+
+      /* Choose the active set of grid points. A point is frozen when its populations changed by less than par->freezeTol (relative) in the last iteration in which it was solved, unless one of its neighbours changed by much more than that. All points are re-activated every par->freezeRefresh iterations.
+      */
+      nActive = par->pIntensity;
+      if(par->freezeTol>0.0){
+        if(par->freezeRefresh>0 && iterThisRun%par->freezeRefresh==0){
+          for(id=0;id<par->pIntensity;id++)
+            stat[id].frozen = 0;
+        }else{
+          for(id=0;id<par->pIntensity;id++)
+            stat[id].frozen = (gp[id].conv==2 && stat[id].relChange>=0.0 && stat[id].relChange<par->freezeTol);
+
+          for(id=0;id<par->pIntensity;id++){
+            if(!stat[id].frozen) continue;
+            for(j=0;j<gp[id].numNeigh;j++){
+              i = gp[id].neigh[j]->id;
+              if(i<par->pIntensity && stat[i].relChange>FREEZE_NEIGH_FACTOR*par->freezeTol){
+                stat[id].frozen = 0;
+                break;
+              }
+            }
+          }
+        }
+
+        nActive = 0;
+        for(id=0;id<par->pIntensity;id++)
+          if(!stat[id].frozen) nActive++;
+
+        if(!silent){
+          snprintf(message, STR_LEN_0, "Active set: %d of %d grid points.", nActive, par->pIntensity);
+          printMessage(message);
+        }
+      }
+      nNgAccepted = 0;
+      nNgRejected = 0;
+
       totalNMaserWarnings = 0;
       nVerticesDone=0;
 #ifndef NO_PROGBARS
       progressIncrementNum=1;
       progFracToPrint = progressIncrementNum*progressIncrement;
 #endif
+      /* Dynamic scheduling would make the results with the default generator depend on the timing of the threads. */
+      if(useCostOrder){
+        gsl_sort_index(vertexOrder, vertexCost, 1, (size_t)par->pIntensity);
+        for(i=0;i<par->pIntensity/2;i++){ /* Reverse, to get decreasing cost. */
+          size_t tempI = vertexOrder[i];
+          vertexOrder[i] = vertexOrder[par->pIntensity-1-i];
+          vertexOrder[par->pIntensity-1-i] = tempI;
+        }
+        omp_set_schedule(omp_sched_dynamic, SOLVER_DYNAMIC_CHUNK);
+      }else
+        omp_set_schedule(omp_sched_static, 0);
+
+      if(vertexColour!=NULL)
+        _sortVerticesByColour(par->pIntensity, vertexColour, numColours, vertexOrder, colourStart);
+
+      for(i=0;i<par->nThreads;i++){
+        threadBusy[i] = 0.0;
+        workspaces[i].nPhotTraced   = 0;
+        workspaces[i].nPhotStopped  = 0;
+        workspaces[i].nStepsTaken   = 0;
+        workspaces[i].nStepsSkipped = 0;
+        workspaces[i].nAliSolves    = 0;
+        workspaces[i].nAliIters     = 0;
+      }
+
+      /* With the ALI schedule, the local equilibrium is solved only a little more accurately than the Monte Carlo noise in the populations, which is roughly 1/SNR, except in the last iteration. This is either the last of par->nSolveIters, or the one added after the convergence criteria are met (see below). */
+      aliTol = TOL;
+      aliMinIters = par->aliMinIters;
+      if(par->aliSchedule==1 && nItersDone<par->nSolveIters-1 && !tightFinalIter){
+        aliTol = (result2>0.0) ? 1.0/(ALI_TOL_SNR_FACTOR*result2) : ALI_TOL_MAX;
+        aliTol = gsl_max(TOL, gsl_min(ALI_TOL_MAX, aliTol));
+        if(aliTol>TOL && aliMinIters>ALI_MIN_ITERS_EARLY)
+          aliMinIters = ALI_MIN_ITERS_EARLY;
+      }
+
       omp_set_dynamic(0);
-#pragma omp parallel private(id,ispec,threadI,nextMolWithBlend,nMaserWarnings) num_threads(par->nThreads)
+#pragma omp parallel private(id,j,ispec,threadI,nMaserWarnings,levOffset) num_threads(par->nThreads)
       {
         threadI = omp_get_thread_num();
 
         if (par->resetRNG==1) gsl_rng_set(threadRans[threadI],RNG_seeds[threadI]);
-        /* Declare and allocate thread-private variables */
-        gridPointData *mp;	// Could have declared them earlier
-        double *halfFirstDs;	// and included them in private() I guess.
-        mp=malloc(sizeof(gridPointData)*par->nSpecies);
-
-#pragma omp for
-        for(id=0;id<par->pIntensity;id++){
+        solverWorkspace *ws = &workspaces[threadI];
+        double vertexStartTime;
+        int colourI,groupI;
+
+        for(colourI=0;colourI<numColours;colourI++){
+#pragma omp for schedule(runtime)
+          for(j=colourStart[colourI];j<colourStart[colourI+1];j++){
+            id = (int)vertexOrder[j];
 #pragma omp atomic
-          ++nVerticesDone;
-
-          nMaserWarnings = 0;
+            ++nVerticesDone;
 
-          for (ispec=0;ispec<par->nSpecies;ispec++){
-            mp[ispec].jbar = malloc(sizeof(double)*md[ispec].nline);
-            mp[ispec].phot = malloc(sizeof(double)*md[ispec].nline*gp[id].nphot);
-            mp[ispec].vfac = malloc(sizeof(double)*                gp[id].nphot);
-            mp[ispec].vfac_loc = malloc(sizeof(double)*            gp[id].nphot);
-          }
-          halfFirstDs = malloc(sizeof(*halfFirstDs)*gp[id].nphot);
+            nMaserWarnings = 0;
 
 #ifndef NO_PROGBARS
-          if (threadI == 0){ /* i.e., is master thread. */
-            progFraction = nVerticesDone/(double)par->pIntensity;
-            if(!silent && progFraction > progFracToPrint){
-              progressbar(progFracToPrint,10);
-              progressIncrementNum++;
-              progFracToPrint = progressIncrementNum*progressIncrement;
+            if (threadI == 0){ /* i.e., is master thread. */
+              progFraction = nVerticesDone/(double)par->pIntensity;
+              if(!silent && progFraction > progFracToPrint){
+                progressbar(progFracToPrint,10);
+                progressIncrementNum++;
+                progFracToPrint = progressIncrementNum*progressIncrement;
+              }
             }
-          }
 #endif
-          if(gp[id].dens[0] > 0 && gp[id].t[0] > 0){
-            _calculateJBar(id,gp,md,threadRans[threadI],par,nlinetot,blends,mp,halfFirstDs,&nMaserWarnings);
-            nextMolWithBlend = 0;
-            for(ispec=0;ispec<par->nSpecies;ispec++){
-              _solveStatEq(id,gp,md,ispec,par,blends,nextMolWithBlend,mp,halfFirstDs,&luWarningGiven);
-              if(par->blend && blends.mols!=NULL && ispec==blends.mols[nextMolWithBlend].molI)
-                nextMolWithBlend++;
+            if(gp[id].dens[0] > 0 && gp[id].t[0] > 0 && !stat[id].frozen){
+              vertexStartTime = omp_get_wtime();
+              if(par->rngType==RNG_PHILOX)
+                rngSetStream(threadRans[threadI], streamSeed, par->resetRNG==1 ? 0 : (unsigned long)nItersDone, (unsigned long)id);
+              _calculateJBar(id,gp,&hotGrid,md,threadRans[threadI],par,nlinetot,blends,ws,pathCachePtr,&nMaserWarnings);
+
+              /* Once the photons are traced, the groups of species are independent of each other, so each can be handed to a task, which may be taken up by any idle thread of the team. The task reads the photons from this thread's workspace and does its own work in that of the thread which runs it; this thread must therefore wait for all the tasks before tracing the photons of its next vertex. */
+              for(groupI=0;groupI<speciesGroups.numGroups;groupI++){
+#pragma omp task if(speciesGroups.numGroups>1)
+                {
+                  solverWorkspace *taskWs = &workspaces[omp_get_thread_num()];
+                  int k,taskSpec;
+
+                  for(k=speciesGroups.groupStart[groupI];k<speciesGroups.groupStart[groupI+1];k++){
+                    taskSpec = speciesGroups.species[k];
+                    _solveStatEq(id,gp,md,taskSpec,par,blends,speciesGroups.blendIndex[taskSpec],taskWs,ws,statEqBands[taskSpec],collCachePtr,aliTol,aliMinIters,&luWarningGiven,&sparseWarningGiven);
+                  }
+                }
+              }
+#pragma omp taskwait
+
+              if(doNgThisIter){
+                levOffset = 0;
+                for(ispec=0;ispec<par->nSpecies;ispec++){
+                  if(_ngExtrapolate(md[ispec].nlev, gp[id].mol[ispec].pops\
+                    , _getHistRow(&stat[id], levOffset+nlevtot*4, md[ispec].nlev, ws->ngHist)\
+                    , _getHistRow(&stat[id], levOffset+nlevtot*3, md[ispec].nlev, ws->ngHist+ws->maxNlev)\
+                    , _getHistRow(&stat[id], levOffset+nlevtot*2, md[ispec].nlev, ws->ngHist+2*ws->maxNlev)\
+                    , ws->tempNewPop)){
+#pragma omp atomic
+                    ++nNgAccepted;
+                  }else{
+#pragma omp atomic
+                    ++nNgRejected;
+                  }
+                  levOffset += md[ispec].nlev;
+                }
+              }
+
+              vertexCost[id] = omp_get_wtime() - vertexStartTime;
+              threadBusy[threadI] += vertexCost[id];
+            }
+            if (threadI == 0){ /* i.e., is master thread */
+              if(!silent) warning("");
             }
-          }
-          if (threadI == 0){ /* i.e., is master thread */
-            if(!silent) warning("");
-          }
-          _freeGridPointData(par->nSpecies, mp);
-          free(halfFirstDs);
 
 #pragma omp atomic
-          totalNMaserWarnings += nMaserWarnings;
+            totalNMaserWarnings += nMaserWarnings;
+          }
+
+          /* Let the photons of the next colour see the new populations of this one: */
+          if(numColours>1){
+#pragma omp for schedule(static)
+            for(j=colourStart[colourI];j<colourStart[colourI+1];j++)
+              _calcPointSpecNumDens(par,md,gp,(int)vertexOrder[j]);
+          }
         }
-        free(mp);
       } /* end parallel block. */
 
+      for(i=0;i<par->nThreads;i++)
+        par->nPhotonSteps += (double)workspaces[i].nStepsTaken;
+
+      if(!silent){
+        minBusy = threadBusy[0];
+        maxBusy = threadBusy[0];
+        sumBusy = 0.0;
+        for(i=0;i<par->nThreads;i++){
+          minBusy = gsl_min(minBusy, threadBusy[i]);
+          maxBusy = gsl_max(maxBusy, threadBusy[i]);
+          sumBusy += threadBusy[i];
+        }
+        snprintf(message, STR_LEN_0, "Thread busy time: min %.2f s, mean %.2f s, max %.2f s.", minBusy, sumBusy/par->nThreads, maxBusy);
+        printMessage(message);
+      }
+
       if(!silent && totalNMaserWarnings>0){
         snprintf(message, STR_LEN_0, "Maser warning: optical depth dropped below -%4.1f %d times this iteration.", MAX_NEG_OPT_DEPTH, totalNMaserWarnings);
         warning(message);
       }
 
+      if(!silent){
+        long nAliSolves=0,nAliIters=0;
+        for(i=0;i<par->nThreads;i++){
+          nAliSolves += workspaces[i].nAliSolves;
+          nAliIters  += workspaces[i].nAliIters;
+        }
+        if(nAliSolves>0){
+          snprintf(message, STR_LEN_0, "ALI iterations: mean %.2f per point and species, tolerance %.1e.", nAliIters/(double)nAliSolves, aliTol);
+          printMessage(message);
+        }
+      }
+
+      if(!silent && par->minPhotonExpTau>0.0){
+        long nPhotTraced=0,nPhotStopped=0,nStepsTaken=0,nStepsSkipped=0;
+        for(i=0;i<par->nThreads;i++){
+          nPhotTraced   += workspaces[i].nPhotTraced;
+          nPhotStopped  += workspaces[i].nPhotStopped;
+          nStepsTaken   += workspaces[i].nStepsTaken;
+          nStepsSkipped += workspaces[i].nStepsSkipped;
+        }
+        if(pathCachePtr!=NULL)
+          snprintf(message, STR_LEN_0, "Photons stopped early: %ld of %ld; %ld steps taken, %ld skipped on cached paths.", nPhotStopped, nPhotTraced, nStepsTaken, nStepsSkipped);
+        else
+          snprintf(message, STR_LEN_0, "Photons stopped early: %ld of %ld; %ld steps taken.", nPhotStopped, nPhotTraced, nStepsTaken);
+        printMessage(message);
+      }
+
+      if(!silent && pathCachePtr!=NULL && iterThisRun==0){
+        snprintf(message, STR_LEN_0, "Photon path cache: %d points, %.1f MB; %d points did not fit.", pathCache.numCached, pathCache.numBytes/1048576.0, pathCache.numOverflow);
+        printMessage(message);
+      }
+
+      if(!silent && doNgThisIter){
+        snprintf(message, STR_LEN_0, "Ng acceleration accepted for %d of %d point/species populations.", nNgAccepted, nNgAccepted+nNgRejected);
+        printMessage(message);
+      }
+
       for(id=0;id<par->pIntensity;id++){
         snr=0;
         n=0;
         for(ilev=0;ilev<md[0].nlev;ilev++) {
           stat[id].ave[ilev]=0;
-          for(iter=0;iter<5;iter++) stat[id].ave[ilev]+=stat[id].pop[ilev+md[0].nlev*iter];
+          for(iter=0;iter<5;iter++) stat[id].ave[ilev]+=_getHistPop(&stat[id], ilev+nlevtot*iter);
           stat[id].ave[ilev]=stat[id].ave[ilev]/5.;
           stat[id].sigma[ilev]=0;
           for(iter=0;iter<5;iter++) {
-            delta_pop = stat[id].pop[ilev+md[0].nlev*iter]-stat[id].ave[ilev];
+            delta_pop = _getHistPop(&stat[id], ilev+nlevtot*iter)-stat[id].ave[ilev];
             stat[id].sigma[ilev]+=delta_pop*delta_pop;
           }
           stat[id].sigma[ilev]=sqrt(stat[id].sigma[ilev]/5.0);
@@ -1082,10 +2975,49 @@ While this is off however, other gsl_* etc calls will not exit if they encounter
         }
         if(n>0) snr=snr/n;
         else if(n==0) snr=1e6;
+        if(photWeights!=NULL) photWeights[id] = (gp[id].dens[0]>0 && gp[id].t[0]>0) ? 1.0/gsl_max(snr,EPS) : 0.0;
         if(snr > 3.) gp[id].conv=2;
         if(snr <= 3 && gp[id].conv==2) gp[id].conv=1;
       }
 
+      if(par->freezeTol>0.0){
+        for(id=0;id<par->pIntensity;id++){
+          if(stat[id].frozen) continue;
+
+          stat[id].relChange = 0.0;
+          levOffset = 0;
+          for(ispec=0;ispec<histNSpecies;ispec++){
+            for(ilev=0;ilev<md[ispec].nlev;ilev++){
+              if(gp[id].mol[ispec].pops[ilev]>minpop_for_convergence_check){
+                delta_pop = fabs(gp[id].mol[ispec].pops[ilev] - _getHistPop(&stat[id], levOffset+ilev+nlevtot*4));
+                stat[id].relChange = gsl_max(stat[id].relChange, delta_pop/gp[id].mol[ispec].pops[ilev]);
+              }
+            }
+            levOffset += md[ispec].nlev;
+          }
+        }
+      }
+
+      if(useConvCriteria){
+        nConverged = 0;
+        maxRelChange = 0.0;
+        for(id=0;id<par->pIntensity;id++){
+          if(gp[id].conv==2) nConverged++;
+
+          levOffset = 0;
+          for(ispec=0;ispec<histNSpecies;ispec++){
+            for(ilev=0;ilev<md[ispec].nlev;ilev++){
+              if(gp[id].mol[ispec].pops[ilev]>minpop_for_convergence_check){
+                delta_pop = fabs(gp[id].mol[ispec].pops[ilev] - _getHistPop(&stat[id], levOffset+ilev+nlevtot*4));
+                maxRelChange = gsl_max(maxRelChange, delta_pop/gp[id].mol[ispec].pops[ilev]);
+              }
+            }
+            levOffset += md[ispec].nlev;
+          }
+        }
+        fracConverged = nConverged/(double)par->pIntensity;
+      }
+
       median=malloc(sizeof(*median)*gsl_max(c,1));
       c=0;
       for(id=0;id<par->pIntensity;id++){
@@ -1103,13 +3035,79 @@ While this is off however, other gsl_* etc calls will not exit if they encounter
 
       if(!silent) progressbar2(par->nSolveIters, 1, nItersDone, percent, result1, result2);
       if(par->outputfile != NULL) popsout(par,gp,md);
+
+      /* The SNR statistics are not meaningful until the 5-deep population history has been filled by the present run. If the criteria are met after an iteration solved at a loose ALI tolerance, one more is done at the full tolerance, after which the solution stops whatever the criteria say.
+      */
+      if(tightFinalIter)
+        par->solverConverged = 1;
+      else if(useConvCriteria && nItersDone-par->nSolveItersDone+1>=5){
+        par->solverConverged = 1;
+        if(par->convMedianSNR>0.0 && result2<par->convMedianSNR)
+          par->solverConverged = 0;
+        if(par->convFracConverged>0.0 && fracConverged<par->convFracConverged)
+          par->solverConverged = 0;
+        if(par->convMaxRelChange>0.0 && maxRelChange>par->convMaxRelChange)
+          par->solverConverged = 0;
+
+        if(!silent && par->solverConverged){
+          snprintf(message, STR_LEN_0, "Convergence criteria met after iteration %d.", nItersDone+1);
+          printMessage(message);
+        }
+
+        if(par->solverConverged && aliTol>TOL && nItersDone+1<par->nSolveIters){
+          par->solverConverged = 0;
+          tightFinalIter = 1;
+          if(!silent) printMessage("Doing one more iteration at the full ALI tolerance.");
+        }
+      }
+
+      /* Re-distribute the photons according to the noise of each point, once the SNR values are meaningful. */
+      if(photWeights!=NULL && iterThisRun+1>=5 && !par->solverConverged && !tightFinalIter && nItersDone+1<par->nSolveIters){
+        newMaxNphot = _setPhotonCounts(par, gp, photWeights, pathCachePtr);
+        if(newMaxNphot>maxNphot){
+          maxNphot = newMaxNphot;
+          for(i=0;i<par->nThreads;i++){
+            _freeSolverWorkspace(par->nSpecies, &workspaces[i]);
+            _mallocSolverWorkspace(par, md, maxNphot, statEqBands, &workspaces[i]);
+            if(workspaces[i].numBytes>peakWorkspaceBytes) peakWorkspaceBytes = workspaces[i].numBytes;
+          }
+          if(!silent){
+            snprintf(message, STR_LEN_0, "Solver workspace grown to %.1f kB per thread.", peakWorkspaceBytes/1024.0);
+            printMessage(message);
+          }
+        }
+        if(!silent){
+          snprintf(message, STR_LEN_0, "Photons re-distributed: maximum now %d per point.", newMaxNphot);
+          printMessage(message);
+        }
+      }
       nItersDone++;
     }
     gsl_set_error_handler(defaultErrorHandler);
     nExtraSolverIters = nItersDone - par->nSolveItersDone;
 
+    if(!silent){
+      snprintf(message, STR_LEN_0, "Non-LTE solution: %d iterations done, %s Ng acceleration.", nExtraSolverIters, par->doNgAccel ? "with" : "without");
+      printMessage(message);
+    }
+
+    _freeSpeciesGroups(&speciesGroups);
     _freeMolsWithBlends(blends.mols, blends.numMolsWithBlends);
+    _unpackHotGrid(par, md, gp, &hotGrid);
     _freeGridCont(par, gp);
+    _freeGridCollRates(par, gp);
+    _freePhotonPathCache(par->pIntensity, &pathCache);
+    _freeCollMatrixCache(par->nSpecies, &collCache);
+    free(photWeights);
+    free(vertexCost);
+    free(vertexOrder);
+    free(vertexColour);
+    free(colourStart);
+
+    for(i=0;i<par->nThreads;i++)
+      _freeSolverWorkspace(par->nSpecies, &workspaces[i]);
+    free(workspaces);
+    _freeStatEqBands(par->nSpecies, statEqBands);
 
     for (i=0;i<par->nThreads;i++){
       gsl_rng_free(threadRans[i]);
@@ -1119,6 +3117,7 @@ While this is off however, other gsl_* etc calls will not exit if they encounter
 
     for(id=0;id<par->pIntensity;id++){
       free(stat[id].pop);
+      free(stat[id].popF);
       free(stat[id].ave);
       free(stat[id].sigma);
     }
@@ -0,0 +1,154 @@
+/*
+ *  sparse.c
+ *  This file is part of LIME, the versatile line modeling engine
+ *
+ *  See ../COPYRIGHT
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "sparse.h"
+
+/*
+Routines for solving the statistical-equilibrium equations of molecules with many levels but comparatively few transitions, for which the cost of dense LU decomposition (of order nlev^3 operations per grid point and iteration) would dominate the run time.
+
+The levels are first renumbered by the reverse Cuthill-McKee algorithm so as to bring the non-zero transition rates as close to the diagonal as possible. The populations are then found by the Grassmann-Taksar-Heyman (GTH) variant of Gaussian elimination, which works with the rates in a band about the diagonal. See
+
+	Grassmann, W. K., Taksar, M. I. & Heyman, D. P. (1985), Operations Research 33, 1107
+
+GTH calculates the pivots as sums of rates rather than as differences, so it involves no subtractions at all and gives populations with small relative error even where these are many orders of magnitude below the largest. It also works directly with the singular rate matrix, so the normalization condition does not need to replace one of the equations.
+*/
+
+/*....................................................................*/
+int
+sparseBandOrdering(const int n, const unsigned char *mask, int *newIndex){
+  /*
+Works out a renumbering of the n levels which reduces the bandwidth of the matrix, mask being an n*n row-major array in which a non-zero value marks a non-zero element. The pattern is treated as symmetric. Level i becomes level newIndex[i]. The return value is the half-width of the band after renumbering, i.e. the largest value of |newIndex[i]-newIndex[j]| for any non-zero element (i,j).
+  */
+  int *degree,*order,i,j,k,m,lev,head,tail,start,bw;
+  unsigned char *visited;
+
+  degree  = malloc(sizeof(*degree) *n);
+  order   = malloc(sizeof(*order)  *n);
+  visited = calloc(n, sizeof(*visited));
+
+  for(i=0;i<n;i++){
+    degree[i] = 0;
+    for(j=0;j<n;j++){
+      if(j!=i && (mask[i*n+j] || mask[j*n+i]))
+        degree[i]++;
+    }
+  }
+
+  /* Breadth-first search from a level of minimum degree, visiting the neighbours of each level in order of increasing degree. This is repeated for each disconnected group of levels. */
+  tail = 0;
+  while(tail<n){
+    start = -1;
+    for(i=0;i<n;i++){
+      if(!visited[i] && (start<0 || degree[i]<degree[start]))
+        start = i;
+    }
+    head = tail;
+    order[tail++] = start;
+    visited[start] = 1;
+
+    while(head<tail){
+      i = order[head++];
+      k = tail;
+      for(j=0;j<n;j++){
+        if(!visited[j] && j!=i && (mask[i*n+j] || mask[j*n+i])){
+          visited[j] = 1;
+          order[tail++] = j;
+        }
+      }
+      /* Insertion sort of the new entries by degree: */
+      for(j=k+1;j<tail;j++){
+        lev = order[j];
+        m = j-1;
+        while(m>=k && degree[order[m]]>degree[lev]){
+          order[m+1] = order[m];
+          m--;
+        }
+        order[m+1] = lev;
+      }
+    }
+  }
+
+  /* Reverse the order: */
+  for(k=0;k<n;k++)
+    newIndex[order[k]] = n-1-k;
+
+  bw = 0;
+  for(i=0;i<n;i++){
+    for(j=0;j<n;j++){
+      if(mask[i*n+j] && abs(newIndex[i]-newIndex[j])>bw)
+        bw = abs(newIndex[i]-newIndex[j]);
+    }
+  }
+
+  free(degree);
+  free(order);
+  free(visited);
+
+  return bw;
+}
+
+/*....................................................................*/
+int
+sparseGthSolve(const int n, const int bw, double *rates, double *x, double *scratch){
+  /*
+Finds the populations x (normalized to sum to 1) which are in equilibrium under the transition rates in the band matrix 'rates', element (i,j) of which (stored at SPARSE_BAND_INDEX(i,j,bw)) is the rate per unit population from level i to level j. The diagonal elements are ignored. The rates are overwritten. The argument scratch must have room for n doubles.
+
+SPARSE_ERR_NEG_RATE is returned if any rate is negative; SPARSE_ERR_NO_OUTFLOW if the levels cannot all be reached from each other, in which case there is no unique solution.
+  */
+  int i,j,k,lo;
+  double sum,f,*outRate=scratch;
+
+  for(i=0;i<n;i++){
+    for(j=(i-bw>0 ? i-bw : 0);j<=i+bw && j<n;j++){
+      if(j!=i && rates[SPARSE_BAND_INDEX(i,j,bw)]<0.0)
+        return SPARSE_ERR_NEG_RATE;
+    }
+  }
+
+  /* Eliminate the levels from the last down to the second, re-routing the rates through each eliminated level k among those which remain. Only levels within bw of k connect to it, so everything stays within the band. */
+  for(k=n-1;k>0;k--){
+    lo = (k-bw>0) ? k-bw : 0;
+
+    sum = 0.0;
+    for(j=lo;j<k;j++)
+      sum += rates[SPARSE_BAND_INDEX(k,j,bw)];
+    if(sum<=0.0)
+      return SPARSE_ERR_NO_OUTFLOW;
+    outRate[k] = sum;
+
+    for(i=lo;i<k;i++){
+      f = rates[SPARSE_BAND_INDEX(i,k,bw)];
+      if(f==0.0) continue;
+      f /= sum;
+      for(j=lo;j<k;j++){
+        if(j!=i)
+          rates[SPARSE_BAND_INDEX(i,j,bw)] += f*rates[SPARSE_BAND_INDEX(k,j,bw)];
+      }
+    }
+  }
+
+  x[0] = 1.0;
+  sum = 1.0;
+  for(k=1;k<n;k++){
+    lo = (k-bw>0) ? k-bw : 0;
+    x[k] = 0.0;
+    for(i=lo;i<k;i++)
+      x[k] += x[i]*rates[SPARSE_BAND_INDEX(i,k,bw)];
+    x[k] /= outRate[k];
+    sum += x[k];
+  }
+
+  for(k=0;k<n;k++)
+    x[k] /= sum;
+
+  return SPARSE_OK;
+}
+
@@ -0,0 +1,26 @@
+/*
+ *  sparse.h
+ *  This file is part of LIME, the versatile line modeling engine
+ *
+ *  See ../COPYRIGHT
+ *
+ */
+
+#ifndef SPARSE_H
+#define SPARSE_H
+
+/* Return values of sparseGthSolve():
+*/
+#define SPARSE_OK		0
+#define SPARSE_ERR_NEG_RATE	1
+#define SPARSE_ERR_NO_OUTFLOW	2
+
+/* Index of element (i,j), |i-j|<=bw, of a band matrix of half-width bw stored by rows. Such a matrix takes n*(2*bw+1) doubles.
+*/
+#define SPARSE_BAND_INDEX(i,j,bw)	((i)*(2*(bw)+1)+(j)-(i)+(bw))
+
+int	sparseBandOrdering(const int, const unsigned char*, int*);
+int	sparseGthSolve(const int, const int, double*, double*, double*);
+
+#endif /* SPARSE_H */
+
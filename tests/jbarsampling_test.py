@@ -0,0 +1,60 @@
+#!/usr/bin/python
+
+# Compares the Monte Carlo noise in the level populations for the two photon samplers selected by par.jbarSampling, for several settings of par.nPhotMin and par.nPhotMax. For each setting the solution is repeated a few times on the same grid, and the noise of each population is taken as its standard deviation across the repeats; the median of population/noise over the grid is printed. This needs the modules compiled by make target 'pyshared', but NOT with DOTEST=yes, since the repeats need different random seeds.
+
+import time
+
+import numpy
+
+import lime
+import pyshared_model as pm
+
+minPop = 1.0e-6    # Populations smaller than this are not included in the statistics.
+numRepeats = 3
+nPhotSettings = [(0,0), (100,400), (50,1000)] # (nPhotMin, nPhotMax) pairs; (0,0) means 200 photons per point throughout.
+gridFileName = "grid_4_jbar.ds"
+
+t0 = time.time()
+
+pm.setUpModel()
+
+def runOnce(jbarSampling, nPhotMin, nPhotMax, writeGrid, popsFileName):
+  if writeGrid:
+    pm.runModel(nSolveIters=10, jbarSampling=jbarSampling, nPhotMin=nPhotMin, nPhotMax=nPhotMax\
+      , gridOutFiles=['','','',gridFileName,popsFileName])
+  else: # All runs after the first solve the same grid.
+    pm.runModel(nSolveIters=10, jbarSampling=jbarSampling, nPhotMin=nPhotMin, nPhotMax=nPhotMax\
+      , gridInFile=gridFileName, gridOutFiles=['','','','',popsFileName])
+  time.sleep(1) # The solver seeds are taken from the clock in seconds.
+
+def medianSNR(popsList):
+  allPops = numpy.array(popsList)
+  meanPops = allPops.mean(axis=0)
+  sigma = allPops.std(axis=0, ddof=1)
+  mask = (meanPops > minPop) & (sigma > 0.0)
+  return (numpy.median(meanPops[mask]/sigma[mask]), numpy.sum(mask))
+
+lime.setSilent(True)
+
+writeGrid = True
+results = []
+for (nPhotMin, nPhotMax) in nPhotSettings:
+  for jbarSampling in [0,1]:
+    popsList = []
+    for ri in range(numRepeats):
+      print "Running LIME with jbarSampling=%d, nPhotMin=%d, nPhotMax=%d (repeat %d of %d)" % (jbarSampling, nPhotMin, nPhotMax, ri+1, numRepeats)
+      popsFileName = "grid_5_jbar_%d_%d_%d_%d.ds" % (jbarSampling, nPhotMin, nPhotMax, ri)
+      runOnce(jbarSampling, nPhotMin, nPhotMax, writeGrid, popsFileName)
+      writeGrid = False
+      popsList.append(pm.readPops(popsFileName))
+
+    (snr, n) = medianSNR(popsList)
+    results.append((nPhotMin, nPhotMax, jbarSampling, snr, n))
+
+print
+print "nPhotMin nPhotMax jbarSampling  median SNR (of %d repeats)" % numRepeats
+for (nPhotMin, nPhotMax, jbarSampling, snr, n) in results:
+  print "%8d %8d %12d  %10.1f (%d populations)" % (nPhotMin, nPhotMax, jbarSampling, snr, n)
+
+t1 = time.time()
+print "Runtime: %ds" % (t1 - t0)
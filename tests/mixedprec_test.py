@@ -0,0 +1,53 @@
+#!/usr/bin/python
+
+# Compares the level populations obtained with par.mixedPrecision set to those of a run in full double precision. This needs the modules compiled by make target 'pyshared'. They should be compiled with DOTEST=yes so that the random seeds are fixed, otherwise the two runs differ by the full Monte Carlo noise and the test is meaningless.
+
+import time
+import math
+
+import lime
+import pyshared_model as pm
+
+maxRelDiff = 1.0e-3 # Largest allowed relative difference between the populations of the two runs.
+minPop = 1.0e-6     # Populations smaller than this are not compared.
+
+t0 = time.time()
+
+pm.setUpModel()
+
+def runOnce(mixedPrecision, gridFileName):
+  # Ng acceleration is switched on so that the population history is actually used.
+  pm.runModel(doNgAccel=True, mixedPrecision=mixedPrecision, gridOutFiles=['','','','',gridFileName])
+
+lime.setSilent(True)
+
+print "Running LIME in double precision:"
+runOnce(False, "grid_5_double.ds")
+print "Running LIME in mixed precision:"
+runOnce(True,  "grid_5_mixed.ds")
+
+popsD = pm.readPops("grid_5_double.ds")
+popsM = pm.readPops("grid_5_mixed.ds")
+
+if popsD.shape != popsM.shape:
+  raise ValueError("Population arrays differ in shape: %s vs %s" % (str(popsD.shape), str(popsM.shape)))
+
+worst = 0.0
+sumSq = 0.0
+n = 0
+for (pD, pM) in zip(popsD.flat, popsM.flat):
+  if pD > minPop:
+    relDiff = abs(pM - pD)/pD
+    worst = max(worst, relDiff)
+    sumSq += relDiff*relDiff
+    n += 1
+
+print "Compared %d populations: rms relative difference %e, largest %e" % (n, math.sqrt(sumSq/max(n,1)), worst)
+
+if worst > maxRelDiff:
+  raise ValueError("Mixed-precision populations differ from double by more than %e" % maxRelDiff)
+
+print "Passed."
+
+t1 = time.time()
+print "Runtime: %ds" % (t1 - t0)
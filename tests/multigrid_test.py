@@ -0,0 +1,44 @@
+#!/usr/bin/python
+
+# Compares a non-LTE solution started from coarse grids (par.multigridLevels>0) with a direct solution of the full grid. Both runs stop on the same convergence criteria; the number of full-grid iterations, read from the NSOLITER and CONVERGD keywords of the grid files written at the end of the solution, and the run time of each are printed. This needs the modules compiled by make target 'pyshared'. They should be compiled with DOTEST=yes so that the random seeds are fixed and the comparison is repeatable.
+
+import time
+
+import lime
+import pyshared_model as pm
+
+maxIters = 40      # Upper limit to the full-grid iterations of each run.
+convMedianSNR = 20.0
+convFracConverged = 0.95
+levelsToTry = [0, 1, 2]
+
+t0 = time.time()
+
+pm.setUpModel()
+
+def runOnce(multigridLevels, gridFileName):
+  # More points than in pyshared_test.py, so that 2 coarse levels can be used.
+  pm.runModel(pIntensity=20000, sinkPoints=5000, nSolveIters=maxIters\
+    , convMedianSNR=convMedianSNR, convFracConverged=convFracConverged\
+    , multigridLevels=multigridLevels, gridOutFiles=['','','','',gridFileName])
+
+lime.setSilent(True)
+
+results = []
+for multigridLevels in levelsToTry:
+  print "Running LIME with multigridLevels=%d:" % multigridLevels
+  gridFileName = "grid_5_multigrid_%d.ds" % multigridLevels
+  tStart = time.time()
+  runOnce(multigridLevels, gridFileName)
+  runTime = time.time() - tStart
+  results.append((multigridLevels, pm.readPrimaryKeyword(gridFileName, 'NSOLITER')\
+    , pm.readPrimaryKeyword(gridFileName, 'CONVERGD'), runTime))
+
+print
+print "Criteria: median SNR >= %.1f, fraction converged >= %.2f, at most %d iterations." % (convMedianSNR, convFracConverged, maxIters)
+print "multigridLevels  full-grid iterations  converged  run time (s)"
+for (multigridLevels, nIters, converged, runTime) in results:
+  print "%15d  %20d  %9s  %12.1f" % (multigridLevels, nIters, "yes" if converged else "no", runTime)
+
+t1 = time.time()
+print "Runtime: %ds" % (t1 - t0)
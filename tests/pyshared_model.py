@@ -0,0 +1,51 @@
+#!/usr/bin/python
+
+# Set-up shared by the test scripts which run the modules compiled by make target 'pyshared' on the model in model_pyshared.py: the model is registered with modellib, and the parameters are those of tests/pyshared_test.py, with any changes passed in as keyword arguments.
+
+from astropy.io import fits
+
+import modellib as ml
+import lime
+
+AU = 1.49598e11    # AU to m
+
+def setUpModel():
+  if not ml.setUserModel("model_pyshared.py"):
+    raise ValueError("Could not set user model.")
+
+  ml.finalizeConfiguration()
+
+def createPars(**changedPars):
+  par = lime.createInputPars()
+
+  par.radius            = 2000.0*AU
+  par.minScale          = 0.5*AU
+  par.pIntensity        = 4000
+  par.sinkPoints        = 3000
+  par.dust              = "jena_thin_e6.tab"
+  par.sampling          = 2
+  par.nSolveIters       = 14
+  par.doSolveRTE        = True
+  par.moldatfile        = ["hco+@xpol.dat"]
+
+  for (name, value) in changedPars.items():
+    if not hasattr(par, name):
+      raise ValueError("Unknown parameter %s" % name)
+    setattr(par, name, value)
+
+  return par
+
+def runModel(**changedPars):
+  lime.runLime(createPars(**changedPars), [])
+
+def readPops(gridFileName, molI=1):
+  hdulist = fits.open(gridFileName)
+  pops = hdulist['LEVEL_POPS_%d' % molI].data.copy()
+  hdulist.close()
+  return pops
+
+def readPrimaryKeyword(gridFileName, keyName):
+  hdulist = fits.open(gridFileName)
+  value = hdulist[0].header[keyName]
+  hdulist.close()
+  return value
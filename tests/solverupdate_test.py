@@ -0,0 +1,43 @@
+#!/usr/bin/python
+
+# Compares the number of solution iterations needed to meet the convergence criteria with par.solverUpdate=0 (Jacobi) and 1 (colour-by-colour Gauss-Seidel). The number of iterations done, and whether the criteria were met, are read from the NSOLITER and CONVERGD keywords of the grid files written at the end of the solution. This needs the modules compiled by make target 'pyshared'. They should be compiled with DOTEST=yes so that the random seeds are fixed and the comparison is repeatable.
+
+import time
+
+import lime
+import pyshared_model as pm
+
+maxIters = 40      # Upper limit to the iterations of each run.
+convMedianSNR = 20.0
+convFracConverged = 0.95
+
+t0 = time.time()
+
+pm.setUpModel()
+
+def runOnce(solverUpdate, gridFileName):
+  pm.runModel(nSolveIters=maxIters, convMedianSNR=convMedianSNR, convFracConverged=convFracConverged\
+    , solverUpdate=solverUpdate, gridOutFiles=['','','','',gridFileName])
+
+def readIters(gridFileName):
+  return (pm.readPrimaryKeyword(gridFileName, 'NSOLITER'), pm.readPrimaryKeyword(gridFileName, 'CONVERGD'))
+
+lime.setSilent(True)
+
+results = []
+for solverUpdate in [0,1]:
+  print "Running LIME with solverUpdate=%d:" % solverUpdate
+  gridFileName = "grid_5_update_%d.ds" % solverUpdate
+  runOnce(solverUpdate, gridFileName)
+  results.append((solverUpdate,) + readIters(gridFileName))
+
+print
+print "Criteria: median SNR >= %.1f, fraction converged >= %.2f, at most %d iterations." % (convMedianSNR, convFracConverged, maxIters)
+for (solverUpdate, nIters, converged) in results:
+  if converged:
+    print "solverUpdate=%d: converged after %d iterations." % (solverUpdate, nIters)
+  else:
+    print "solverUpdate=%d: not converged after %d iterations." % (solverUpdate, nIters)
+
+t1 = time.time()
+print "Runtime: %ds" % (t1 - t0)